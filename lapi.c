@@ -1158,14 +1158,9 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
-LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
-                      const char *chunkname, const char *mode) {
-  ZIO z;
-  int status;
-  lua_lock(L);
-  if (!chunkname) chunkname = "?";
-  luaZ_init(L, &z, reader, data);
-  status = luaD_protectedparser(L, &z, chunkname, mode);
+static int loadchunk (lua_State *L, ZIO *z, const char *chunkname,
+                      const char *mode, ChunkImage **img) {
+  int status = luaD_protectedparser(L, z, chunkname, mode, img);
   if (status == LUA_OK) {  /* no errors? */
     LClosure *f = clLvalue(L->top - 1);  /* get newly created function */
     if (f->nupvalues >= 1) {  /* does it have an upvalue? */
@@ -1177,6 +1172,58 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
       luaC_upvalbarrier(L, f->upvals[0]);
     }
   }
+  return status;
+}
+
+
+LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
+                      const char *chunkname, const char *mode) {
+  ZIO z;
+  int status;
+  lua_lock(L);
+  if (!chunkname) chunkname = "?";
+  luaZ_init(L, &z, reader, data);
+  status = loadchunk(L, &z, chunkname, mode, NULL);
+  lua_unlock(L);
+  return status;
+}
+
+
+static const char *getimage (lua_State *L, void *ud, size_t *size) {
+  ChunkImage *desc = cast(ChunkImage *, ud);
+  UNUSED(L);
+  if (desc->nref++ > 0)  /* already read? */
+    return NULL;
+  *size = desc->size;
+  return cast(const char *, desc->buff);
+}
+
+
+/*
+** Load a chunk that is all in memory at 'buff'. Functions loaded from a
+** chunk image (see 'lua_dumpimage') keep using their code and line
+** information in place, and never write them; so, the same (read-only)
+** buffer can serve any number of states, even in different threads.
+** The buffer is released with 'release' (if not NULL) when none of
+** these functions needs it any more; after loading other chunks, it is
+** released before returning.
+*/
+LUA_API int lua_loadimage (lua_State *L, void *buff, size_t sz,
+                           const char *chunkname, const char *mode,
+                           lua_Release release, void *ud) {
+  ZIO z;
+  ChunkImage desc;
+  ChunkImage *img = &desc;
+  int status;
+  lua_lock(L);
+  if (!chunkname) chunkname = "?";
+  desc.buff = buff; desc.size = sz;
+  desc.release = release; desc.ud = ud;
+  desc.nref = 0;  /* used by 'getimage' */
+  luaZ_init(L, &z, getimage, &desc);
+  status = loadchunk(L, &z, chunkname, mode, &img);
+  if (img == &desc && release)  /* buffer not used in place? */
+    (*release)(ud, buff, sz);
   lua_unlock(L);
   return status;
 }
@@ -1189,7 +1236,7 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   api_checknelems(L, 1);
   o = L->top - 1;
   if (isLfunction(o))
-    status = luaU_dump(L, getproto(o), writer, data, strip);
+    status = luaU_dump(L, getproto(o), writer, data, strip, 0);
   else
     status = 1;
   lua_unlock(L);
@@ -1197,6 +1244,43 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+/*
+** Dump a function as a chunk image, which 'lua_loadimage' can use in
+** place; other loaders load it as a regular binary chunk.
+*/
+LUA_API int lua_dumpimage (lua_State *L, lua_Writer writer, void *data,
+                           int strip) {
+  int status;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = L->top - 1;
+  if (isLfunction(o))
+    status = luaU_dump(L, getproto(o), writer, data, strip, 1);
+  else
+    status = 1;
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Set the optimization level used when compiling chunks from now on
+** (a negative 'level' only queries it). Returns the previous level.
+*/
+LUA_API int lua_setoptlevel (lua_State *L, int level) {
+  global_State *g;
+  int old;
+  lua_lock(L);
+  g = G(L);
+  old = g->optlevel;
+  if (level >= 0)
+    g->optlevel = cast_byte(level < MAXOPTLEVEL ? level : MAXOPTLEVEL);
+  lua_unlock(L);
+  return old;
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -1267,6 +1351,14 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCSETSOFTLIMIT: case LUA_GCSETHARDLIMIT: {
+      /* limits are in Kbytes; 0 means no limit */
+      lu_mem *limit = (what == LUA_GCSETSOFTLIMIT) ? &g->GCsoftlimit
+                                                  : &g->GChardlimit;
+      res = (*limit == MAX_LUMEM) ? 0 : cast_int(*limit >> 10);
+      *limit = (data <= 0) ? MAX_LUMEM : cast(lu_mem, data) << 10;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1275,6 +1367,32 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 
 
 
+
+LUA_API void lua_getgcstats (lua_State *L, lua_GCStats *s) {
+  lua_lock(L);
+  luaC_getstats(G(L), s);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_getstackstats (lua_State *L, lua_StackStats *ss) {
+  lua_lock(L);
+  *ss = G(L)->stackstats;
+  lua_unlock(L);
+}
+
+
+/*
+** Set a function to be called when a collection cycle starts or ends.
+** It runs inside the collector, so it must not call the Lua API.
+*/
+LUA_API void lua_setgccallback (lua_State *L, lua_GCCallback f, void *ud) {
+  lua_lock(L);
+  G(L)->gccallback = f;
+  G(L)->gcud = ud;
+  lua_unlock(L);
+}
+
 /*
 ** miscellaneous functions
 */
@@ -1363,8 +1481,8 @@ LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
 
 
 
-static const char *aux_upvalue (StkId fi, int n, TValue **val,
-                                CClosure **owner, UpVal **uv) {
+static const char *aux_upvalue (lua_State *L, StkId fi, int n,
+                                TValue **val, CClosure **owner, UpVal **uv) {
   switch (ttype(fi)) {
     case LUA_TCCL: {  /* C closure */
       CClosure *f = clCvalue(fi);
@@ -1378,6 +1496,7 @@ static const char *aux_upvalue (StkId fi, int n, TValue **val,
       TString *name;
       Proto *p = f->p;
       if (!(1 <= n && n <= p->sizeupvalues)) return NULL;
+      luaU_needdebug(L, p);
       *val = f->upvals[n-1]->v;
       if (uv) *uv = f->upvals[n - 1];
       name = p->upvalues[n-1].name;
@@ -1392,7 +1511,7 @@ LUA_API const char *lua_getupvalue (lua_State *L, int funcindex, int n) {
   const char *name;
   TValue *val = NULL;  /* to avoid warnings */
   lua_lock(L);
-  name = aux_upvalue(index2addr(L, funcindex), n, &val, NULL, NULL);
+  name = aux_upvalue(L, index2addr(L, funcindex), n, &val, NULL, NULL);
   if (name) {
     setobj2s(L, L->top, val);
     api_incr_top(L);
@@ -1411,7 +1530,7 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
   lua_lock(L);
   fi = index2addr(L, funcindex);
   api_checknelems(L, 1);
-  name = aux_upvalue(fi, n, &val, &owner, &uv);
+  name = aux_upvalue(L, fi, n, &val, &owner, &uv);
   if (name) {
     L->top--;
     setobj(L, val, L->top);
@@ -705,6 +705,67 @@ static int skipcomment (LoadF *lf, int *cp) {
 }
 
 
+#if !defined(l_mapfile)	/* { */
+
+#if defined(LUA_USE_POSIX)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+** Map file 'f' read-only: its pages are shared with other processes
+** that map the same file
+*/
+static void *l_mapfile (FILE *f, size_t *size) {
+  struct stat st;
+  void *p;
+  if (fstat(fileno(f), &st) != 0 || st.st_size <= 0)
+    return NULL;
+  p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  if (p == MAP_FAILED) return NULL;
+  *size = (size_t)st.st_size;
+  return p;
+}
+
+
+static void l_unmapfile (void *ud, void *p, size_t size) {
+  (void)ud;
+  munmap(p, size);
+}
+
+#else
+
+#define l_mapfile(f,sz)		((void)(f), (void)(sz), (void *)NULL)
+
+static void l_unmapfile (void *ud, void *p, size_t size) {
+  (void)ud; (void)p; (void)size;
+}
+
+#endif
+
+#endif				/* } */
+
+
+/*
+** Load binary file 'f' as a mapped chunk image (see 'lua_loadimage').
+** Returns -1 if the file cannot be mapped or the chunk does not start
+** it (e.g., after a BOM).
+*/
+static int loadmapped (lua_State *L, FILE *f, const char *chunkname,
+                                              const char *mode) {
+  size_t size;
+  void *p = l_mapfile(f, &size);
+  if (p == NULL)
+    return -1;
+  else if (*(const char *)p != LUA_SIGNATURE[0]) {
+    l_unmapfile(NULL, p, size);
+    return -1;
+  }
+  else
+    return lua_loadimage(L, p, size, chunkname, mode, l_unmapfile, NULL);
+}
+
+
 /*
 ** 加载Lua文件
 */
@@ -728,7 +789,12 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
   if (c == LUA_SIGNATURE[0] && filename) {  /* binary file? */
     lf.f = freopen(filename, "rb", lf.f);  /* reopen in binary mode */
     if (lf.f == NULL) return errfile(L, "reopen", fnameindex);
-    skipcomment(&lf, &c);  /* re-read initial portion */
+    if (!skipcomment(&lf, &c) &&  /* re-read initial portion */
+        (status = loadmapped(L, lf.f, lua_tostring(L, -1), mode)) >= 0) {
+      fclose(lf.f);
+      lua_remove(L, fnameindex);
+      return status;
+    }
   }
   if (c != EOF)
     lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
@@ -773,6 +839,48 @@ LUALIB_API int luaL_loadstring (lua_State *L, const char *s) {
   return luaL_loadbuffer(L, s, strlen(s), s);
 }
 
+
+typedef struct Frozen {
+  char *p;
+  size_t n;  /* bytes written */
+  size_t size;  /* size of block 'p' */
+} Frozen;
+
+
+static int writefrozen (lua_State *L, const void *b, size_t size, void *ud) {
+  Frozen *fz = (Frozen *)ud;
+  (void)L;  /* not used */
+  if (size > fz->size - fz->n) {  /* must grow block? */
+    size_t newsize = (fz->size + size) * 2;
+    char *np = (char *)realloc(fz->p, newsize);
+    if (np == NULL) return 1;
+    fz->p = np;
+    fz->size = newsize;
+  }
+  memcpy(fz->p + fz->n, b, size);
+  fz->n += size;
+  return 0;
+}
+
+
+/*
+** Freeze the Lua function on the top of the stack into a chunk image
+** in a block from 'malloc', outside any state. Any state in the process
+** can then create closures over it with 'lua_loadimage' (passing no
+** 'release' function), sharing its code; the caller frees the block
+** after closing all those states. Returns NULL if it fails.
+*/
+LUALIB_API void *luaL_freeze (lua_State *L, int strip, size_t *sz) {
+  Frozen fz;
+  fz.p = NULL; fz.n = fz.size = 0;
+  if (lua_dumpimage(L, writefrozen, &fz, strip) != 0) {
+    free(fz.p);
+    return NULL;
+  }
+  *sz = fz.n;
+  return fz.p;
+}
+
 /* }====================================================== */
 
 
@@ -88,6 +88,7 @@ LUALIB_API int (luaL_loadfilex) (lua_State *L, const char *filename,
 LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
                                    const char *name, const char *mode);
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
+LUALIB_API void *(luaL_freeze) (lua_State *L, int strip, size_t *sz);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
 
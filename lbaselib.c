@@ -171,16 +171,68 @@ static int luaB_rawset (lua_State *L) {
 }
 
 
+/*
+** Push a table with the statistics of the collector (see 'lua_GCStats').
+*/
+static int pushgcstats (lua_State *L) {
+  static const char *const states[LUA_GCNUMSTATES] = {"propagate",
+    "atomic", "swpallgc", "swpfinobj", "swptobefnz", "swpend", "callfin",
+    "pause"};
+  lua_GCStats s;
+  int i;
+  lua_getgcstats(L, &s);
+  lua_createtable(L, 0, 13);
+  lua_createtable(L, 0, LUA_GCNUMSTATES);
+  for (i = 0; i < LUA_GCNUMSTATES; i++) {
+    lua_pushnumber(L, (lua_Number)s.time[i]);
+    lua_setfield(L, -2, states[i]);
+  }
+  lua_setfield(L, -2, "time");
+  lua_createtable(L, LUA_GCHISTSIZE, 0);
+  for (i = 0; i < LUA_GCHISTSIZE; i++) {
+    lua_pushinteger(L, (lua_Integer)s.steptimes[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "steptimes");
+  lua_pushnumber(L, (lua_Number)s.lastatomic);
+  lua_setfield(L, -2, "lastatomic");
+  lua_pushnumber(L, (lua_Number)s.maxatomic);
+  lua_setfield(L, -2, "maxatomic");
+  lua_pushinteger(L, (lua_Integer)s.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushinteger(L, (lua_Integer)s.steps);
+  lua_setfield(L, -2, "steps");
+  lua_pushinteger(L, (lua_Integer)s.traversed);
+  lua_setfield(L, -2, "traversed");
+  lua_pushinteger(L, (lua_Integer)s.swept);
+  lua_setfield(L, -2, "swept");
+  lua_pushinteger(L, (lua_Integer)s.finalizers);
+  lua_setfield(L, -2, "finalizers");
+  lua_pushinteger(L, (lua_Integer)s.estimate);
+  lua_setfield(L, -2, "estimate");
+  lua_pushinteger(L, (lua_Integer)s.totalbytes);
+  lua_setfield(L, -2, "totalbytes");
+  lua_pushinteger(L, (lua_Integer)s.debt);
+  lua_setfield(L, -2, "debt");
+  lua_pushstring(L, states[s.state]);
+  lua_setfield(L, -2, "state");
+  return 1;
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", NULL};
+    "isrunning", "setsoftlimit", "sethardlimit", "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING};
+    LUA_GCISRUNNING, LUA_GCSETSOFTLIMIT, LUA_GCSETHARDLIMIT, -1};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
-  int ex = (int)luaL_optinteger(L, 2, 0);
-  int res = lua_gc(L, o, ex);
+  int ex, res;
+  if (o == -1)  /* "stats"? */
+    return pushgcstats(L);
+  ex = (int)luaL_optinteger(L, 2, 0);
+  res = lua_gc(L, o, ex);
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
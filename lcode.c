@@ -13,6 +13,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -56,6 +57,51 @@ static int tonumeral(const expdesc *e, TValue *v) {
 }
 
 
+/*
+** If expression is a constant (numeral, string, nil or boolean), fills
+** 'v' with its value and returns 1. Otherwise, returns 0.
+*/
+int luaK_exp2const (FuncState *fs, const expdesc *e, TValue *v) {
+  if (hasjumps(e))
+    return 0;
+  switch (e->k) {
+    case VNIL: setnilvalue(v); return 1;
+    case VTRUE: case VFALSE: setbvalue(v, e->k == VTRUE); return 1;
+    case VK: {
+      TValue *k = &fs->f->k[e->u.info];
+      if (!ttisstring(k)) return 0;
+      setobj(fs->ls->L, v, k);
+      return 1;
+    }
+    case VCONST: {
+      setobj(fs->ls->L, v, &fs->ls->dyd->cst.arr[e->u.info].k);
+      return 1;
+    }
+    default: return tonumeral(e, v);
+  }
+}
+
+
+/*
+** Turn a compile-time constant variable into its value, with constants
+** in the current function.
+*/
+static void const2exp (FuncState *fs, expdesc *e) {
+  TValue *v = &fs->ls->dyd->cst.arr[e->u.info].k;
+  switch (ttype(v)) {
+    case LUA_TNUMINT: e->k = VKINT; e->u.ival = ivalue(v); break;
+    case LUA_TNUMFLT: e->k = VKFLT; e->u.nval = fltvalue(v); break;
+    case LUA_TNIL: e->k = VNIL; break;
+    case LUA_TBOOLEAN: e->k = bvalue(v) ? VTRUE : VFALSE; break;
+    default:
+      lua_assert(ttisstring(v));
+      e->k = VK;
+      e->u.info = luaK_stringK(fs, tsvalue(v));
+      break;
+  }
+}
+
+
 /*
 ** Create a OP_LOADNIL instruction, but try to optimize: if the previous
 ** instruction is also OP_LOADNIL and ranges are compatible, adjust
@@ -287,6 +333,65 @@ void luaK_patchclose (FuncState *fs, int list, int level) {
 }
 
 
+/* limit for difference between lines in relative line info. */
+#define LIMLINEDIFF	0x80
+
+
+/*
+** Save line info for instruction 'pc'. If difference from last line
+** does not fit in a byte, or after that many instructions, save a new
+** absolute line info; (in that case, the special value 'ABSLINEINFO'
+** in 'lineinfo' signals the existence of this absolute information.)
+** Otherwise, store the difference from last line in 'lineinfo'.
+*/
+static void savelineinfo (FuncState *fs, Proto *f, int pc, int line) {
+  int linedif = line - fs->previousline;
+  if (abs(linedif) >= LIMLINEDIFF || fs->iwthabs++ >= MAXIWTHABS) {
+    luaM_growvector(fs->ls->L, f->abslineinfo, fs->nabslineinfo,
+                    f->sizeabslineinfo, AbsLineInfo, MAX_INT, "lines");
+    f->abslineinfo[fs->nabslineinfo].pc = pc;
+    f->abslineinfo[fs->nabslineinfo++].line = line;
+    linedif = ABSLINEINFO;  /* signal that there is absolute information */
+    fs->iwthabs = 1;  /* restart counter */
+  }
+  luaM_growvector(fs->ls->L, f->lineinfo, pc, f->sizelineinfo, ls_byte,
+                  MAX_INT, "opcodes");
+  f->lineinfo[pc] = linedif;
+  fs->previousline = line;  /* last line saved */
+}
+
+
+/*
+** Remove line information from the last instruction.
+** If line information for that instruction is absolute, set 'iwthabs'
+** above its max to force the new (replacing) instruction to have
+** absolute line info, too.
+*/
+static void removelastlineinfo (FuncState *fs) {
+  Proto *f = fs->f;
+  int pc = fs->pc - 1;  /* last instruction coded */
+  if (f->lineinfo[pc] != ABSLINEINFO) {  /* relative line info? */
+    fs->previousline -= f->lineinfo[pc];  /* correct last line saved */
+    fs->iwthabs--;  /* undo previous increment */
+  }
+  else {  /* absolute line information */
+    lua_assert(f->abslineinfo[fs->nabslineinfo - 1].pc == pc);
+    fs->nabslineinfo--;  /* remove it */
+    fs->iwthabs = MAXIWTHABS + 1;  /* force next line info to be absolute */
+  }
+}
+
+
+/*
+** Remove the last instruction created, correcting line information
+** accordingly.
+*/
+static void removelastinstruction (FuncState *fs) {
+  removelastlineinfo(fs);
+  fs->pc--;
+}
+
+
 /*
 ** Emit instruction 'i', checking for array sizes and saving also its
 ** line information. Return 'i' position.
@@ -301,10 +406,7 @@ static int luaK_code (FuncState *fs, Instruction i) {
   luaM_growvector(fs->ls->L, f->code, fs->pc, f->sizecode, Instruction,
                   MAX_INT, "opcodes");
   f->code[fs->pc] = i;
-  /* save corresponding line information */
-  luaM_growvector(fs->ls->L, f->lineinfo, fs->pc, f->sizelineinfo, int,
-                  MAX_INT, "opcodes");
-  f->lineinfo[fs->pc] = fs->ls->lastline;
+  savelineinfo(fs, f, fs->pc, fs->ls->lastline);
   return fs->pc++;
 }
 
@@ -566,6 +668,10 @@ void luaK_setoneret (FuncState *fs, expdesc *e) {
 */
 void luaK_dischargevars (FuncState *fs, expdesc *e) {
   switch (e->k) {
+    case VCONST: {
+      const2exp(fs, e);
+      break;
+    }
     case VLOCAL: {  /* already in a register */
       e->k = VNONRELOC;  /* becomes a non-relocatable value */
       break;
@@ -860,7 +966,7 @@ static int jumponcond (FuncState *fs, expdesc *e, int cond) {
   if (e->k == VRELOCABLE) {
     Instruction ie = getinstruction(fs, e);
     if (GET_OPCODE(ie) == OP_NOT) {
-      fs->pc--;  /* remove previous OP_NOT */
+      removelastinstruction(fs);  /* remove previous OP_NOT */
       return condjump(fs, OP_TEST, GETARG_B(ie), 0, !cond);
     }
     /* else go through */
@@ -1050,14 +1156,106 @@ static void codebinexpval (FuncState *fs, OpCode op,
 }
 
 
+/*
+** Check whether expression 'e' is an integer numeral that fits in
+** a 'sC' argument; if so, put its value in '*imm'.
+*/
+static int isSCint (expdesc *e, int *imm) {
+  if (e->k == VKINT && !hasjumps(e) && fitsC(e->u.ival)) {
+    *imm = cast_int(e->u.ival);
+    return 1;
+  }
+  else
+    return 0;
+}
+
+
+/*
+** Emit code for 'e1 + e2' when 'e1' is in a register and 'e2' is a
+** numeric constant: OP_ADDI for small integers, OP_ADDK otherwise.
+** Return 0 (emitting nothing) if operands do not have those forms.
+*/
+static int codeaddk (FuncState *fs, expdesc *e1, expdesc *e2, int line) {
+  int r1, imm;
+  if (e1->k != VNONRELOC || !tonumeral(e2, NULL))
+    return 0;
+  r1 = e1->u.info;
+  if (isSCint(e2, &imm)) {
+    freeexp(fs, e1);
+    e1->u.info = luaK_codeABC(fs, OP_ADDI, 0, r1, int2sC(imm));
+  }
+  else {
+    int rk2 = luaK_exp2RK(fs, e2);
+    if (!ISK(rk2))  /* too many constants? */
+      return 0;  /* 'e2' is now in a register; use the generic opcode */
+    freeexp(fs, e1);
+    e1->u.info = luaK_codeABC(fs, OP_ADDK, 0, r1, INDEXK(rk2));
+  }
+  e1->k = VRELOCABLE;
+  luaK_fixline(fs, line);
+  return 1;
+}
+
+
+/*
+** Emit code for an order comparison where one operand is a small
+** integer numeral, using the immediate opcodes. The other operand
+** goes to a register; comparisons with the immediate at the left are
+** coded with the "reversed" opcodes, so that metamethods still see
+** operands in their original order. Return 0 (emitting nothing) if
+** no operand is a suitable immediate.
+*/
+static int codeorderimm (FuncState *fs, BinOpr opr, expdesc *e1,
+                                                    expdesc *e2) {
+  int r, imm;
+  OpCode op;
+  if (e1->k == VNONRELOC && isSCint(e2, &imm)) {  /* 'a op imm' */
+    r = e1->u.info;
+    switch (opr) {
+      case OPR_LT: op = OP_LTI; break;
+      case OPR_LE: op = OP_LEI; break;
+      case OPR_GT: op = OP_GTI; break;
+      default: op = OP_GEI; break;
+    }
+  }
+  else if (isSCint(e1, &imm)) {  /* 'imm op b' */
+    r = luaK_exp2anyreg(fs, e2);
+    switch (opr) {
+      case OPR_LT: op = OP_GTI; break;  /* 'imm < b' ==> 'b > imm' */
+      case OPR_LE: op = OP_GEI; break;  /* 'imm <= b' ==> 'b >= imm' */
+      case OPR_GT: op = OP_LTI; break;  /* 'imm > b' ==> 'b < imm' */
+      default: op = OP_LEI; break;  /* 'imm >= b' ==> 'b <= imm' */
+    }
+  }
+  else
+    return 0;
+  freeexps(fs, e1, e2);
+  e1->u.info = condjump(fs, op, 1, r, int2sC(imm));
+  e1->k = VJMP;
+  return 1;
+}
+
+
 /*
 ** Emit code for comparisons.
-** 'e1' was already put in R/K form by 'luaK_infix'.
+** 'e1' was already put in R/K form by 'luaK_infix', unless it is
+** a numeral.
 */
 static void codecomp (FuncState *fs, BinOpr opr, expdesc *e1, expdesc *e2) {
-  int rk1 = (e1->k == VK) ? RKASK(e1->u.info)
-                          : check_exp(e1->k == VNONRELOC, e1->u.info);
-  int rk2 = luaK_exp2RK(fs, e2);
+  int rk1, rk2;
+  if (opr != OPR_EQ && opr != OPR_NE && codeorderimm(fs, opr, e1, e2))
+    return;
+  rk2 = luaK_exp2RK(fs, e2);
+  rk1 = luaK_exp2RK(fs, e1);
+  if ((opr == OPR_EQ || opr == OPR_NE) && ISK(rk1) != ISK(rk2)) {
+    /* equality against a constant: register goes in 'B' */
+    int r = ISK(rk1) ? rk2 : rk1;
+    int k = INDEXK(ISK(rk1) ? rk1 : rk2);
+    freeexps(fs, e1, e2);
+    e1->u.info = condjump(fs, OP_EQK, opr == OPR_EQ, r, k);
+    e1->k = VJMP;
+    return;
+  }
   freeexps(fs, e1, e2);
   switch (opr) {
     case OPR_NE: {  /* '(a ~= b)' ==> 'not (a == b)' */
@@ -1127,8 +1325,10 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
       /* else keep numeral, which may be folded with 2nd operand */
       break;
     }
-    default: {
-      luaK_exp2RK(fs, v);
+    default: {  /* comparisons */
+      if (!tonumeral(v, NULL))
+        luaK_exp2RK(fs, v);
+      /* else keep numeral, which may become an immediate operand */
       break;
     }
   }
@@ -1177,7 +1377,8 @@ void luaK_posfix (FuncState *fs, BinOpr op,
     case OPR_IDIV: case OPR_MOD: case OPR_POW:
     case OPR_BAND: case OPR_BOR: case OPR_BXOR:
     case OPR_SHL: case OPR_SHR: {
-      if (!constfolding(fs, op + LUA_OPADD, e1, e2))
+      if (!constfolding(fs, op + LUA_OPADD, e1, e2) &&
+          !(op == OPR_ADD && codeaddk(fs, e1, e2, line)))
         codebinexpval(fs, cast(OpCode, op + OP_ADD), e1, e2, line);
       break;
     }
@@ -1195,7 +1396,8 @@ void luaK_posfix (FuncState *fs, BinOpr op,
 ** Change line information associated with current position.
 */
 void luaK_fixline (FuncState *fs, int line) {
-  fs->f->lineinfo[fs->pc - 1] = line;
+  removelastlineinfo(fs);
+  savelineinfo(fs, fs->f, fs->pc - 1, line);
 }
 
 
@@ -1221,3 +1423,757 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================
+** Optimizer
+** Optional passes over the code of a finished function, run by
+** 'close_func' before the code is resized and fused. Level 1 folds
+** constant tests, threads jumps and removes dead code; level 2 also
+** propagates copies, coalesces registers and removes dead stores into
+** temporaries, guided by a liveness analysis of the registers. Only
+** registers not holding active local variables are ever rewritten, so
+** locals keep their values for the debug interface.
+** =======================================================
+*/
+
+#if !defined(LUAI_MAXOPTPASSES)
+#define LUAI_MAXOPTPASSES	8
+#endif
+
+/* instruction flags */
+#define OTARGET		1	/* entered from somewhere other than 'pc - 1' */
+#define OREACH		2	/* reachable from the function entry */
+#define ODEAD		4	/* to be removed */
+
+/* register sets */
+#define testreg(s,r)	((s)[(r) >> 3] & (1 << ((r) & 7)))
+#define setreg(s,r)	((s)[(r) >> 3] |= cast_byte(1 << ((r) & 7)))
+
+#define createjump(a,sbx)	CREATE_ABx(OP_JMP, a, (sbx) + MAXARG_sBx)
+
+typedef struct OptState {
+  FuncState *fs;
+  Instruction *code;
+  int n;  /* number of instructions */
+  int nreg;  /* number of registers */
+  int nbytes;  /* size of a register set */
+  int *aux;  /* 'n + 1' entries: work stack, active locals, new positions */
+  int *lines;  /* line of each instruction */
+  int moved;  /* were instructions removed? */
+  lu_byte *flags;  /* one entry per instruction */
+  lu_byte *captured;  /* registers captured by closures */
+  lu_byte *use, *def, *out;  /* scratch sets */
+  lu_byte *live;  /* registers live on entry to each instruction */
+} OptState;
+
+
+static void setregs (OptState *os, lu_byte *s, int from, int to) {
+  if (to > os->nreg) to = os->nreg;
+  for (; from < to; from++)
+    setreg(s, from);
+}
+
+
+static void userk (lu_byte *s, int rk) {
+  if (!ISK(rk)) setreg(s, rk);
+}
+
+
+/*
+** Fill 'use' with the registers read by 'i' and 'def' with the ones it
+** surely writes. When a range is open (up to the top) all registers
+** above its base are read and none is written.
+*/
+static void usedef (OptState *os, Instruction i, lu_byte *use, lu_byte *def) {
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  memset(use, 0, os->nbytes);
+  memset(def, 0, os->nbytes);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+    case OP_ADDI: case OP_ADDK:
+      setreg(use, b); setreg(def, a); break;
+    case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL: case OP_GETUPVAL:
+    case OP_NEWTABLE:
+      setreg(def, a); break;
+    case OP_LOADNIL: setregs(os, def, a, a + b + 1); break;
+    case OP_GETTABUP: userk(use, c); setreg(def, a); break;
+    case OP_GETTABLE: setreg(use, b); userk(use, c); setreg(def, a); break;
+    case OP_SETTABUP: case OP_EQ: case OP_LT: case OP_LE:
+      userk(use, b); userk(use, c); break;
+    case OP_SETTABLE: setreg(use, a); userk(use, b); userk(use, c); break;
+    case OP_SETUPVAL: case OP_TEST: setreg(use, a); break;
+    case OP_SELF:
+      setreg(use, b); userk(use, c); setregs(os, def, a, a + 2); break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR:
+      userk(use, b); userk(use, c); setreg(def, a); break;
+    case OP_CONCAT: setregs(os, use, b, c + 1); setreg(def, a); break;
+    case OP_EQK: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+    case OP_TESTSET:  /* writes 'a' only when it jumps */
+      setreg(use, b); break;
+    case OP_CALL:
+      setregs(os, use, a, b ? a + b : os->nreg);
+      if (c) setregs(os, def, a, a + c - 1);
+      break;
+    case OP_TAILCALL: setregs(os, use, a, b ? a + b : os->nreg); break;
+    case OP_RETURN: setregs(os, use, a, b ? a + b - 1 : os->nreg); break;
+    case OP_FORLOOP: case OP_FORPREP: setregs(os, use, a, a + 3); break;
+    case OP_TFORCALL:
+      setregs(os, use, a, a + 3); setregs(os, def, a + 3, a + 3 + c); break;
+    case OP_TFORLOOP: setreg(use, a + 1); break;
+    case OP_SETLIST: setregs(os, use, a, b ? a + b + 1 : os->nreg); break;
+    case OP_VARARG: if (b) setregs(os, def, a, a + b - 1); break;
+    case OP_CLOSURE: {
+      Proto *p = os->fs->f->p[GETARG_Bx(i)];
+      int k;
+      for (k = 0; k < p->sizeupvalues; k++)
+        if (p->upvalues[k].instack) setreg(use, p->upvalues[k].idx);
+      setreg(def, a);
+      break;
+    }
+    case OP_JMP: case OP_EXTRAARG: break;
+    default: lua_assert(0);  /* no fused or quickened code yet */
+  }
+}
+
+
+/*
+** Whether 'i' may change register 'r' (including writes done only on
+** some paths and the garbage left by calls).
+*/
+static int maywrite (OptState *os, Instruction i, int r) {
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_TESTSET: case OP_FORPREP: case OP_TFORLOOP: return (r == a);
+    case OP_FORLOOP: return (r == a || r == a + 3);
+    case OP_CALL: case OP_VARARG: case OP_TFORCALL: return (r >= a);
+    case OP_CONCAT: return (r == a || (GETARG_B(i) <= r && r <= GETARG_C(i)));
+    default:
+      usedef(os, i, os->use, os->def);
+      return testreg(os->def, r);
+  }
+}
+
+
+/*
+** Fill 's' with the successors of instruction 'pc'; return how many.
+*/
+static int successors (OptState *os, int pc, int *s) {
+  Instruction i = os->code[pc];
+  OpCode op = GET_OPCODE(i);
+  switch (op) {
+    case OP_JMP: case OP_FORPREP:
+      s[0] = pc + 1 + GETARG_sBx(i);
+      return 1;
+    case OP_FORLOOP: case OP_TFORLOOP:
+      s[0] = pc + 1; s[1] = pc + 1 + GETARG_sBx(i);
+      return 2;
+    case OP_RETURN: return 0;
+    case OP_LOADBOOL:
+      s[0] = pc + 1 + (GETARG_C(i) != 0);
+      return 1;
+    default:
+      s[0] = pc + 1;
+      if (!testTMode(op)) return 1;
+      s[1] = pc + 2;  /* tests may skip their jump */
+      return 2;
+  }
+}
+
+
+static void marktargets (OptState *os) {
+  int pc, k, s[2];
+  for (pc = 0; pc < os->n; pc++)
+    os->flags[pc] &= ~OTARGET;
+  for (pc = 0; pc < os->n; pc++) {
+    for (k = successors(os, pc, s); k-- > 0; ) {
+      if (s[k] != pc + 1 && s[k] < os->n)
+        os->flags[s[k]] |= OTARGET;
+    }
+  }
+}
+
+
+/* true if the instruction at 'pc' can only be entered from 'pc - 1' */
+#define sameblock(os,pc)  \
+	((pc) > 0 && !((os)->flags[pc] & OTARGET) && \
+	 !((os)->flags[(pc) - 1] & ODEAD))
+
+/* true if the instruction before 'pc' is a test (so 'pc' is its jump) */
+#define aftertest(os,pc)  \
+	((pc) > 0 && testTMode(GET_OPCODE((os)->code[(pc) - 1])))
+
+
+/*
+** Constant value of operand 'rk' of the instruction at 'pc': a constant
+** itself or a register loaded by the previous instruction.
+*/
+static const TValue *constop (OptState *os, int pc, int rk) {
+  TValue *k = os->fs->f->k;
+  Instruction prev;
+  if (ISK(rk))
+    return &k[INDEXK(rk)];
+  if (!sameblock(os, pc))
+    return NULL;
+  prev = os->code[pc - 1];
+  if (GET_OPCODE(prev) == OP_LOADK && GETARG_A(prev) == rk)
+    return &k[GETARG_Bx(prev)];
+  return NULL;
+}
+
+
+/*
+** Evaluate comparison 'op' over constants. Order comparisons are only
+** done between numbers of the same subtype, which cannot call
+** metamethods or depend on conversions.
+*/
+static int cmpconst (OpCode op, const TValue *v1, const TValue *v2,
+                     int *res) {
+  if (op == OP_EQ || op == OP_EQK) {
+    *res = luaV_rawequalobj(v1, v2);
+    return 1;
+  }
+  if (ttisinteger(v1) && ttisinteger(v2)) {
+    lua_Integer i1 = ivalue(v1), i2 = ivalue(v2);
+    switch (op) {
+      case OP_LT: case OP_LTI: *res = (i1 < i2); break;
+      case OP_LE: case OP_LEI: *res = (i1 <= i2); break;
+      case OP_GTI: *res = (i1 > i2); break;
+      default: lua_assert(op == OP_GEI); *res = (i1 >= i2); break;
+    }
+  }
+  else if (ttisfloat(v1) && ttisfloat(v2)) {
+    lua_Number n1 = fltvalue(v1), n2 = fltvalue(v2);
+    switch (op) {
+      case OP_LT: case OP_LTI: *res = luai_numlt(n1, n2); break;
+      case OP_LE: case OP_LEI: *res = luai_numle(n1, n2); break;
+      case OP_GTI: *res = luai_numlt(n2, n1); break;
+      default: lua_assert(op == OP_GEI); *res = luai_numle(n2, n1); break;
+    }
+  }
+  else
+    return 0;
+  return 1;
+}
+
+
+/*
+** Fold a comparison of constants into a jump: to its own jump when
+** the condition holds, over it otherwise.
+*/
+static int foldtest (OptState *os, int pc) {
+  Instruction i = os->code[pc];
+  OpCode op = GET_OPCODE(i);
+  const TValue *v1, *v2;
+  TValue imm;
+  int res;
+  switch (op) {
+    case OP_EQ: case OP_LT: case OP_LE:
+      v1 = constop(os, pc, GETARG_B(i));
+      v2 = constop(os, pc, GETARG_C(i));
+      break;
+    case OP_EQK:
+      v1 = constop(os, pc, GETARG_B(i));
+      v2 = &os->fs->f->k[GETARG_C(i)];
+      break;
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      v1 = constop(os, pc, GETARG_B(i));
+      setivalue(&imm, GETARG_sC(i));
+      v2 = &imm;
+      break;
+    default: return 0;
+  }
+  if (v1 == NULL || v2 == NULL || !cmpconst(op, v1, v2, &res))
+    return 0;
+  os->code[pc] = createjump(0, (res == GETARG_A(i)) ? 0 : 1);
+  return 1;
+}
+
+
+/*
+** Fold 'not' of a register loaded with a constant by the previous
+** instruction.
+*/
+static int foldnot (OptState *os, int pc) {
+  Instruction i = os->code[pc];
+  int b = GETARG_B(i);
+  Instruction prev;
+  int v;
+  if (!sameblock(os, pc))
+    return 0;
+  prev = os->code[pc - 1];
+  switch (GET_OPCODE(prev)) {
+    case OP_LOADK:
+      if (GETARG_A(prev) != b) return 0;
+      v = l_isfalse(&os->fs->f->k[GETARG_Bx(prev)]);
+      break;
+    case OP_LOADBOOL:
+      if (GETARG_A(prev) != b || GETARG_C(prev) != 0) return 0;
+      v = !GETARG_B(prev);
+      break;
+    case OP_LOADNIL:
+      if (b < GETARG_A(prev) || b > GETARG_A(prev) + GETARG_B(prev)) return 0;
+      v = 1;
+      break;
+    default: return 0;
+  }
+  os->code[pc] = CREATE_ABC(OP_LOADBOOL, GETARG_A(i), v, 0);
+  return 1;
+}
+
+
+/*
+** Make a jump go directly to the end of a chain of jumps (closing the
+** lowest level closed along the chain), or replace it by the 'return'
+** it leads to.
+*/
+static int threadjump (OptState *os, int pc) {
+  Instruction *code = os->code;
+  int a = GETARG_A(code[pc]);
+  int dest = pc + 1 + GETARG_sBx(code[pc]);
+  int count;
+  for (count = 0; count < os->n && dest != pc &&
+                  GET_OPCODE(code[dest]) == OP_JMP; count++) {
+    int da = GETARG_A(code[dest]);
+    if (da != 0 && (a == 0 || da < a)) a = da;
+    dest += 1 + GETARG_sBx(code[dest]);
+  }
+  if (GET_OPCODE(code[dest]) == OP_RETURN && GETARG_B(code[dest]) != 0 &&
+      !aftertest(os, pc)) {
+    code[pc] = code[dest];  /* 'return' closes any pending upvalue */
+    return 1;
+  }
+  if ((dest == pc + 1 + GETARG_sBx(code[pc]) && a == GETARG_A(code[pc])) ||
+      abs(dest - (pc + 1)) > MAXARG_sBx)
+    return 0;
+  code[pc] = createjump(a, dest - (pc + 1));
+  return 1;
+}
+
+
+static int simplify (OptState *os) {
+  int pc, changed = 0;
+  marktargets(os);
+  for (pc = 0; pc < os->n; pc++) {
+    switch (GET_OPCODE(os->code[pc])) {
+      case OP_NOT: changed += foldnot(os, pc); break;
+      case OP_JMP: break;
+      default: changed += foldtest(os, pc); break;
+    }
+    if (GET_OPCODE(os->code[pc]) == OP_JMP)
+      changed += threadjump(os, pc);
+  }
+  return changed;
+}
+
+
+/*
+** {------------------------------------------------------
+** Register optimizations (level 2)
+** -------------------------------------------------------
+*/
+
+/* true if 'r' holds no active local variable at 'pc' */
+#define istemp(os,r,pc)	((r) >= (os)->aux[pc])
+
+
+static void countactive (OptState *os) {
+  Proto *f = os->fs->f;
+  int *nact = os->aux;
+  int pc, v;
+  for (pc = 0; pc <= os->n; pc++)
+    nact[pc] = 0;
+  for (v = 0; v < os->fs->nlocvars; v++) {
+    LocVar *lv = &f->locvars[v];
+    if (lv->startpc < lv->endpc) {
+      nact[lv->startpc]++;
+      nact[lv->endpc]--;
+    }
+  }
+  for (pc = 1; pc <= os->n; pc++)
+    nact[pc] += nact[pc - 1];
+}
+
+
+/* registers live after instruction 'pc' go to 'os->out' */
+static void liveout (OptState *os, int pc) {
+  int k, b, s[2];
+  memset(os->out, 0, os->nbytes);
+  for (k = successors(os, pc, s); k-- > 0; ) {
+    if (s[k] < os->n) {
+      lu_byte *in = os->live + s[k] * os->nbytes;
+      for (b = 0; b < os->nbytes; b++)
+        os->out[b] |= in[b];
+    }
+  }
+}
+
+
+static void liveness (OptState *os) {
+  int nb = os->nbytes;
+  int pc, b, changed;
+  memset(os->live, 0, os->n * nb);
+  do {
+    changed = 0;
+    for (pc = os->n - 1; pc >= 0; pc--) {
+      lu_byte *in = os->live + pc * nb;
+      liveout(os, pc);
+      usedef(os, os->code[pc], os->use, os->def);
+      for (b = 0; b < nb; b++) {
+        lu_byte v = os->use[b] | (os->out[b] & ~os->def[b]);
+        if (v != in[b]) {
+          in[b] = v;
+          changed = 1;
+        }
+      }
+    }
+  } while (changed);
+}
+
+
+/*
+** Replace reads of register 'r' in instruction 'pc' by reads of 'nr'.
+** Return the number of replacements, or -1 if 'r' is read in a way
+** that cannot be changed (a range, a loop control, etc.).
+*/
+static int substreg (OptState *os, int pc, int r, int nr) {
+  Instruction *pi = &os->code[pc];
+  OpCode op = GET_OPCODE(*pi);
+  int n = 0;
+  usedef(os, *pi, os->use, os->def);
+  if (!testreg(os->use, r))
+    return 0;
+  switch (op) {
+    case OP_TEST: case OP_SETTABLE: case OP_SETUPVAL:
+      if (GETARG_A(*pi) == r) { SETARG_A(*pi, nr); n++; }
+      if (op == OP_SETUPVAL || op == OP_TEST) break;
+      /* FALLTHROUGH */
+    case OP_MOVE: case OP_GETTABUP: case OP_GETTABLE: case OP_SETTABUP:
+    case OP_SELF: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+    case OP_BXOR: case OP_SHL: case OP_SHR: case OP_UNM: case OP_BNOT:
+    case OP_NOT: case OP_LEN: case OP_EQ: case OP_LT: case OP_LE:
+    case OP_TESTSET: case OP_ADDI: case OP_ADDK: case OP_EQK:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      if (getBMode(op) != OpArgU && getBMode(op) != OpArgN &&
+          GETARG_B(*pi) == r) { SETARG_B(*pi, nr); n++; }
+      if (getCMode(op) == OpArgK && GETARG_C(*pi) == r) {
+        SETARG_C(*pi, nr); n++;
+      }
+      break;
+    default: return -1;
+  }
+  lua_assert(n > 0);
+  return n;
+}
+
+
+/*
+** Copy propagation: after 'MOVE t a' (with 't' a temporary), read 'a'
+** instead of 't' until the end of the basic block or until any of
+** them may change. Registers captured by closures are left alone, as
+** any call could change them.
+*/
+static int propagate (OptState *os) {
+  int pc, j, changed = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = os->code[pc];
+    int t = GETARG_A(i), a = GETARG_B(i);
+    if (GET_OPCODE(i) != OP_MOVE || t == a || !istemp(os, t, pc + 1) ||
+        testreg(os->captured, t) || testreg(os->captured, a))
+      continue;
+    for (j = pc + 1; j < os->n && !(os->flags[j] & OTARGET); j++) {
+      int s[2];
+      int n = substreg(os, j, t, a);
+      if (n < 0) break;
+      changed += n;
+      if (maywrite(os, os->code[j], t) || maywrite(os, os->code[j], a) ||
+          successors(os, j, s) != 1 || s[0] != j + 1)
+        break;
+    }
+  }
+  return changed;
+}
+
+
+/* instructions without side effects that only write register A */
+static int ispure (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_NEWTABLE:
+    case OP_CLOSURE: case OP_NOT:
+      return 1;
+    case OP_LOADBOOL: return (GETARG_C(i) == 0);
+    default: return 0;
+  }
+}
+
+
+/* instructions that only write register A, after reading all operands */
+static int issingledest (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_GETTABUP: case OP_GETTABLE: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_MOD: case OP_POW: case OP_DIV: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+    case OP_UNM: case OP_BNOT: case OP_LEN: case OP_CONCAT:
+    case OP_ADDI: case OP_ADDK:
+      return 1;
+    default: return ispure(i);
+  }
+}
+
+
+/*
+** Remove stores into dead temporaries and useless moves, and make
+** 'OP t ...; MOVE x t' (with 't' dead after the move) write 'x'
+** directly.
+*/
+static int coalesce (OptState *os) {
+  Instruction *code = os->code;
+  int pc, changed = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = code[pc];
+    int a = GETARG_A(i);
+    if (os->flags[pc] & ODEAD)
+      continue;
+    if (GET_OPCODE(i) == OP_MOVE &&
+        (a == GETARG_B(i) ||  /* 'MOVE a a'? */
+         (sameblock(os, pc) && GET_OPCODE(code[pc - 1]) == OP_MOVE &&
+          GETARG_A(code[pc - 1]) == GETARG_B(i) &&
+          GETARG_B(code[pc - 1]) == a))) {  /* 'MOVE b a; MOVE a b'? */
+      os->flags[pc] |= ODEAD;
+      changed++;
+      continue;
+    }
+    if (GET_OPCODE(i) == OP_LOADNIL) {  /* dead only if all are dead */
+      int r;
+      liveout(os, pc);
+      for (r = a; r <= a + GETARG_B(i); r++) {
+        if (!istemp(os, r, pc + 1) || testreg(os->out, r) ||
+            testreg(os->captured, r))
+          break;
+      }
+      if (r > a + GETARG_B(i)) {
+        os->flags[pc] |= ODEAD;
+        changed++;
+      }
+      continue;
+    }
+    if (!issingledest(i) || !istemp(os, a, pc + 1) ||
+        testreg(os->captured, a))
+      continue;
+    liveout(os, pc);
+    if (!testreg(os->out, a)) {
+      if (ispure(i)) {  /* dead store? */
+        os->flags[pc] |= ODEAD;
+        changed++;
+      }
+    }
+    else if (pc + 1 < os->n && sameblock(os, pc + 1)) {
+      Instruction mv = code[pc + 1];
+      int x = GETARG_A(mv);
+      if (GET_OPCODE(mv) == OP_MOVE && GETARG_B(mv) == a && x != a &&
+          istemp(os, a, pc + 2) &&
+          !(GET_OPCODE(i) == OP_CONCAT &&
+            GETARG_B(i) <= x && x <= GETARG_C(i))) {
+        liveout(os, pc + 1);
+        if (!testreg(os->out, a)) {
+          SETARG_A(code[pc], x);
+          os->flags[pc + 1] |= ODEAD;
+          changed++;
+          pc++;  /* skip removed move */
+        }
+      }
+    }
+  }
+  return changed;
+}
+
+
+static int optregs (OptState *os) {
+  int changed;
+  countactive(os);
+  marktargets(os);
+  changed = propagate(os);
+  liveness(os);
+  return changed + coalesce(os);
+}
+
+/* }------------------------------------------------------ */
+
+
+/*
+** Mark reachable instructions, using 'aux' as a work stack.
+*/
+static void markreachable (OptState *os) {
+  int *stack = os->aux;
+  int top = 0;
+  int pc, k, s[2];
+  for (pc = 0; pc < os->n; pc++)
+    os->flags[pc] &= ~OREACH;
+  os->flags[0] |= OREACH;
+  stack[top++] = 0;
+  while (top > 0) {
+    pc = stack[--top];
+    for (k = successors(os, pc, s); k-- > 0; ) {
+      if (s[k] < os->n && !(os->flags[s[k]] & OREACH)) {
+        os->flags[s[k]] |= OREACH;
+        stack[top++] = s[k];
+      }
+    }
+  }
+}
+
+
+/*
+** Remove unreachable code, jumps to the next instruction and whatever
+** other passes marked as dead, fixing jump offsets, line information
+** and the ranges of local variables. A removed position maps to the
+** next instruction kept. The final 'return' is always kept.
+*/
+static int removedead (OptState *os) {
+  Proto *f = os->fs->f;
+  Instruction *code = os->code;
+  int *map = os->aux;
+  int pc, n, v;
+  markreachable(os);
+  for (pc = 0, n = 0; pc < os->n - 1; pc++) {
+    Instruction i = code[pc];
+    if (!(os->flags[pc] & OREACH) ||
+        (GET_OPCODE(i) == OP_JMP && GETARG_A(i) == 0 &&
+         GETARG_sBx(i) == 0 && !aftertest(os, pc)))
+      os->flags[pc] |= ODEAD;
+    if (os->flags[pc] & ODEAD) n++;
+  }
+  os->flags[os->n - 1] &= ~ODEAD;
+  if (n == 0)
+    return 0;
+  for (pc = 0, n = 0; pc < os->n; pc++) {
+    map[pc] = n;
+    if (!(os->flags[pc] & ODEAD)) n++;
+  }
+  map[os->n] = n;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction i = code[pc];
+    if (os->flags[pc] & ODEAD)
+      continue;
+    switch (GET_OPCODE(i)) {
+      case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP: {
+        int dest = map[pc + 1 + GETARG_sBx(i)];
+        SETARG_sBx(i, dest - (map[pc] + 1));
+        break;
+      }
+      case OP_LOADBOOL: {
+        if (GETARG_C(i) && map[pc + 2] == map[pc] + 1)
+          SETARG_C(i, 0);  /* skipped instruction was removed */
+        break;
+      }
+      default: break;
+    }
+    code[map[pc]] = i;
+    os->lines[map[pc]] = os->lines[pc];
+  }
+  for (v = 0; v < os->fs->nlocvars; v++) {
+    f->locvars[v].startpc = map[f->locvars[v].startpc];
+    f->locvars[v].endpc = map[f->locvars[v].endpc];
+  }
+  os->n = n;
+  os->moved = 1;
+  memset(os->flags, 0, n);
+  return 1;
+}
+
+
+/*
+** Decode the line information of the code into 'lines', where
+** 'removedead' can move it with the instructions
+*/
+static void getlines (OptState *os) {
+  Proto *f = os->fs->f;
+  int line = f->linedefined;
+  int pc, k = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    if (f->lineinfo[pc] != ABSLINEINFO)
+      line += f->lineinfo[pc];
+    else {
+      lua_assert(k < os->fs->nabslineinfo && f->abslineinfo[k].pc == pc);
+      line = f->abslineinfo[k++].line;
+    }
+    os->lines[pc] = line;
+  }
+}
+
+
+/*
+** Encode again the line information of the remaining code
+*/
+static void setlines (OptState *os) {
+  FuncState *fs = os->fs;
+  int pc;
+  fs->previousline = fs->f->linedefined;
+  fs->iwthabs = 0;
+  fs->nabslineinfo = 0;
+  for (pc = 0; pc < os->n; pc++)
+    savelineinfo(fs, fs->f, pc, os->lines[pc]);
+}
+
+
+static void markcaptured (OptState *os) {
+  Proto *f = os->fs->f;
+  int p, k;
+  memset(os->captured, 0, os->nbytes);
+  for (p = 0; p < os->fs->np; p++) {
+    for (k = 0; k < f->p[p]->sizeupvalues; k++) {
+      if (f->p[p]->upvalues[k].instack)
+        setreg(os->captured, f->p[p]->upvalues[k].idx);
+    }
+  }
+}
+
+
+void luaK_optimize (FuncState *fs) {
+  lua_State *L = fs->ls->L;
+  Mbuffer *buff = fs->ls->buff;  /* free between tokens; used as work area */
+  int level = G(L)->optlevel;
+  OptState os;
+  size_t size;
+  int pass;
+  if (level == 0 || fs->pc <= 1)
+    return;
+  os.fs = fs;
+  os.code = fs->f->code;
+  os.n = fs->pc;
+  os.nreg = fs->f->maxstacksize;
+  os.nbytes = (os.nreg >> 3) + 1;
+  size = (2 * os.n + 1) * sizeof(int) + os.n + (os.n + 4) * os.nbytes;
+  if (luaZ_sizebuffer(buff) < size)
+    luaZ_resizebuffer(L, buff, size);
+  os.aux = cast(int *, luaZ_buffer(buff));
+  os.lines = os.aux + os.n + 1;
+  os.moved = 0;
+  os.flags = cast(lu_byte *, os.lines + os.n);
+  os.captured = os.flags + os.n;
+  os.use = os.captured + os.nbytes;
+  os.def = os.use + os.nbytes;
+  os.out = os.def + os.nbytes;
+  os.live = os.out + os.nbytes;
+  memset(os.flags, 0, os.n);
+  getlines(&os);
+  markcaptured(&os);
+  for (pass = 0; pass < LUAI_MAXOPTPASSES; pass++) {
+    int changed = simplify(&os);
+    if (level >= 2)
+      changed += optregs(&os);
+    changed += removedead(&os);
+    if (!changed) break;
+  }
+  fs->pc = os.n;
+  if (os.moved)
+    setlines(&os);
+}
+
+/* }====================================================== */
@@ -429,6 +429,217 @@ static int db_traceback (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Sampling profiler
+** =======================================================
+*/
+
+/*
+** 'l_proftimer(L,us)' starts a timer that requests a profiler sample
+** of state 'L' every 'us' microseconds of CPU time (or stops it, if
+** 'L' is NULL), returning 0 on failure. There is only one timer for
+** the whole process.
+*/
+#if !defined(l_proftimer)	/* { */
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <signal.h>
+#include <sys/time.h>
+
+static lua_State *volatile profL = NULL;  /* state being profiled */
+
+static void profhandler (int i) {
+  lua_State *L = profL;
+  (void)i;  /* unused arg. */
+  if (L != NULL)
+    lua_profsample(L);
+}
+
+static int l_proftimer (lua_State *L, lua_Integer us) {
+  struct sigaction sa;
+  struct itimerval it;
+  memset(&sa, 0, sizeof(sa));
+  memset(&it, 0, sizeof(it));
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;  /* do not interrupt system calls */
+  if (L == NULL) {
+    sa.sa_handler = SIG_IGN;  /* (a signal may still be on its way) */
+    profL = NULL;
+    return (setitimer(ITIMER_PROF, &it, NULL) == 0 &&
+            sigaction(SIGPROF, &sa, NULL) == 0);
+  }
+  sa.sa_handler = profhandler;
+  it.it_interval.tv_sec = (time_t)(us / 1000000);
+  it.it_interval.tv_usec = (suseconds_t)(us % 1000000);
+  it.it_value = it.it_interval;
+  profL = L;
+  return (sigaction(SIGPROF, &sa, NULL) == 0 &&
+          setitimer(ITIMER_PROF, &it, NULL) == 0);
+}
+
+#else				/* }{ */
+
+/* ISO C has no timers */
+#define l_proftimer(L,us)	((void)(L), (void)(us), 0)
+
+#endif				/* } */
+
+#endif				/* } */
+
+
+/*
+** The registry[&PROFKEY] holds a userdata whose finalizer stops the
+** timer when the state is closed while profiling.
+*/
+static const int PROFKEY = 0;
+
+
+static int stoptimer (lua_State *L) {
+  (void)L;
+  (void)l_proftimer(NULL, 0);
+  return 0;
+}
+
+
+static int profwriter (lua_State *L, const void *b, size_t size, void *B) {
+  (void)L;
+  luaL_addlstring((luaL_Buffer *)B, (const char *)b, size);
+  return 0;
+}
+
+
+static void pushprofile (lua_State *L) {
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  lua_profdump(L, profwriter, &b);
+  luaL_pushresult(&b);
+}
+
+
+/*
+** debug.profile("start" [, interval [, mode [, size]]]) starts sampling
+** every 'interval' microseconds (default 1000), keeping up to 'size'
+** distinct stacks; mode "l" distinguishes current lines, not only
+** functions. debug.profile("dump") returns the samples as folded
+** stacks; debug.profile("stop") also stops profiling and frees them.
+*/
+static int db_profile (lua_State *L) {
+  static const char *const opts[] = {"start", "stop", "dump", NULL};
+  switch (luaL_checkoption(L, 1, NULL, opts)) {
+    case 0: {  /* start */
+      lua_Integer us = luaL_optinteger(L, 2, 1000);
+      int lines = (strcmp(luaL_optstring(L, 3, ""), "l") == 0);
+      int size = (int)luaL_optinteger(L, 4, 0);
+      luaL_argcheck(L, 0 < us && us <= 1000000, 2, "interval out of range");
+      if (lua_rawgetp(L, LUA_REGISTRYINDEX, &PROFKEY) == LUA_TNIL) {
+        lua_newuserdata(L, 0);  /* create sentinel */
+        lua_createtable(L, 0, 1);
+        lua_pushcfunction(L, stoptimer);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &PROFKEY);
+      }
+      lua_profstart(L, size, lines);
+      if (!l_proftimer(L, us)) {
+        lua_profstop(L);
+        return luaL_error(L, "cannot start profiler timer");
+      }
+      return 0;
+    }
+    case 1: {  /* stop */
+      (void)l_proftimer(NULL, 0);
+      pushprofile(L);
+      lua_profstop(L);
+      return 1;
+    }
+    default: {  /* dump */
+      pushprofile(L);
+      return 1;
+    }
+  }
+}
+
+
+static void pushheapprofile (lua_State *L, int live) {
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  lua_heapprofdump(L, profwriter, &b, live);
+  luaL_pushresult(&b);
+}
+
+
+/*
+** debug.heapprofile("start" [, interval [, size]]) starts sampling
+** allocations, about once every 'interval' bytes. debug.heapprofile(
+** "dump" [, "total"]) returns, as folded stacks, the bytes still alive
+** (or all bytes allocated) by each sampled stack; debug.heapprofile(
+** "stop") returns the live bytes and stops profiling.
+*/
+static int db_heapprofile (lua_State *L) {
+  static const char *const opts[] = {"start", "stop", "dump", NULL};
+  switch (luaL_checkoption(L, 1, NULL, opts)) {
+    case 0: {  /* start */
+      lua_Integer interval = luaL_optinteger(L, 2, 0);
+      int size = (int)luaL_optinteger(L, 3, 0);
+      luaL_argcheck(L, 0 <= interval && interval <= INT_MAX, 2,
+                       "interval out of range");
+      lua_heapprofstart(L, (int)interval, size);
+      return 0;
+    }
+    case 1: {  /* stop */
+      pushheapprofile(L, 1);
+      lua_heapprofstop(L);
+      return 1;
+    }
+    default: {  /* dump */
+      pushheapprofile(L, strcmp(luaL_optstring(L, 2, "live"), "total") != 0);
+      return 1;
+    }
+  }
+}
+
+
+static int filewriter (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** debug.heapsnapshot(path) writes a snapshot of all live objects (see
+** 'lua_heapsnapshot') to file 'path'.
+*/
+static int db_heapsnapshot (lua_State *L) {
+  const char *path = luaL_checkstring(L, 1);
+  FILE *f = fopen(path, "wb");
+  int status;
+  if (f == NULL)
+    return luaL_fileresult(L, 0, path);
+  status = lua_heapsnapshot(L, filewriter, f);
+  if (fclose(f) != 0) status = 1;
+  return luaL_fileresult(L, status == 0, path);
+}
+
+/* }====================================================== */
+
+
+/*
+** debug.opstats([what]): opcode statistics (see 'lua_getopstats');
+** 'what' defaults to "c".
+*/
+static int db_opstats (lua_State *L) {
+  const char *what = luaL_optstring(L, 1, "c");
+  int n;
+  luaL_checkstack(L, (int)strlen(what), "too many options");
+  n = lua_getopstats(L, what);
+  if (n < 0)
+    return luaL_error(L, "opcode statistics not enabled (LUAI_OPSTATS)");
+  return n;
+}
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -445,6 +656,10 @@ static const luaL_Reg dblib[] = {
   {"setlocal", db_setlocal},
   {"setmetatable", db_setmetatable},
   {"setupvalue", db_setupvalue},
+  {"heapprofile", db_heapprofile},
+  {"heapsnapshot", db_heapsnapshot},
+  {"opstats", db_opstats},
+  {"profile", db_profile},
   {"traceback", db_traceback},
   {NULL, NULL}
 };
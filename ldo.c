@@ -26,6 +26,7 @@
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lparser.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -84,10 +85,23 @@
 
 #if defined(__cplusplus) && !defined(LUA_USE_LONGJMP)	/* { */
 
-/* C++ exceptions */
+/*
+** C++ exceptions: 'try' costs nothing until something is thrown. Lua
+** errors are thrown as 'struct lua_longjmp *', a type no other code
+** throws, so they pass through host C++ frames running destructors
+** (hosts must rethrow what their 'catch(...)' clauses get). Other
+** exceptions reaching a protected call (e.g., thrown by a C++ function
+** called from Lua) become runtime errors (see 'foreignerror').
+*/
+#include <exception>
+
+#define LUAI_CXXERRORS
 #define LUAI_THROW(L,c)		throw(c)
 #define LUAI_TRY(L,c,a) \
-	try { a } catch(...) { if ((c)->status == 0) (c)->status = -1; }
+	try { a } \
+	catch (struct lua_longjmp *) { lua_assert((c)->status != LUA_OK); } \
+	catch (std::exception &e) { foreignerror(L, c, e.what()); } \
+	catch (...) { foreignerror(L, c, NULL); }
 #define luai_jmpbuf		int  /* dummy variable */
 
 #elif defined(LUA_USE_POSIX)				/* }{ */
@@ -122,6 +136,25 @@ struct lua_longjmp {
 };
 
 
+#if defined(LUAI_CXXERRORS)
+/*
+** Turn a foreign exception caught by protected call 'c' into a runtime
+** error, with message 'what' if given. Runs inside the 'catch' clause
+** (which owns 'what'), with the previous handler already restored, so
+** that errors here go to it.
+*/
+static void foreignerror (lua_State *L, struct lua_longjmp *c,
+                          const char *what) {
+  L->errorJmp = c->previous;
+  c->status = LUA_ERRRUN;
+  if (what)
+    luaO_pushfstring(L, "C++ exception: %s", what);
+  else
+    luaO_pushfstring(L, "C++ exception");
+}
+#endif
+
+
 static void seterrorobj (lua_State *L, int errcode, StkId oldtop) {
   switch (errcode) {
     case LUA_ERRMEM: {  /* memory error? */
@@ -210,15 +243,17 @@ int luaD_rawrunprotected (lua_State *L, Pfunc f, void *ud) {
 static void correctstack (lua_State *L, TValue *oldstack) {
   CallInfo *ci;
   UpVal *up;
+  size_t n = 0;
   L->top = (L->top - oldstack) + L->stack;
-  for (up = L->openupval; up != NULL; up = up->u.open.next)
+  for (up = L->openupval; up != NULL; up = up->u.open.next, n++)
     up->v = (up->v - oldstack) + L->stack;
-  for (ci = L->ci; ci != NULL; ci = ci->previous) {
+  for (ci = L->ci; ci != NULL; ci = ci->previous, n++) {
     ci->top = (ci->top - oldstack) + L->stack;
     ci->func = (ci->func - oldstack) + L->stack;
     if (isLua(ci))
       ci->u.l.base = (ci->u.l.base - oldstack) + L->stack;
   }
+  G(L)->stackstats.fixups += n;
 }
 
 
@@ -230,11 +265,16 @@ static void correctstack (lua_State *L, TValue *oldstack) {
 ** 重新分配一块stack内容,并且进行拷贝
 */
 void luaD_reallocstack (lua_State *L, int newsize) {
+  lua_StackStats *ss = &G(L)->stackstats;
   TValue *oldstack = L->stack;
   int lim = L->stacksize;
   lua_assert(newsize <= LUAI_MAXSTACK || newsize == ERRORSTACKSIZE);
   lua_assert(L->stack_last - L->stack == L->stacksize - EXTRA_STACK);
   luaM_reallocvector(L, L->stack, L->stacksize, newsize, TValue);
+  if (newsize > lim) ss->grows++;
+  else ss->shrinks++;
+  ss->moved += (newsize < lim) ? newsize : lim;
+  if (newsize > ss->maxsize) ss->maxsize = newsize;
   for (; lim < newsize; lim++)
     setnilvalue(L->stack + lim); /* erase new segment */
   L->stacksize = newsize;
@@ -276,11 +316,19 @@ static int stackinuse (lua_State *L) {
 }
 
 
+/*
+** A stack only shrinks when it is more than about three times larger
+** than its part in use, and then to twice that part. So, a thread
+** whose depth oscillates does not keep reallocating its stack (each
+** reallocation also corrects every CallInfo and open upvalue).
+*/
 void luaD_shrinkstack (lua_State *L) {
   int inuse = stackinuse(L);
-  int goodsize = inuse + (inuse / 8) + 2*EXTRA_STACK;
+  int goodsize = 2*inuse + 2*EXTRA_STACK;
   if (goodsize > LUAI_MAXSTACK)
     goodsize = LUAI_MAXSTACK;  /* respect stack limit */
+  else if (goodsize < BASIC_STACK_SIZE)
+    goodsize = BASIC_STACK_SIZE;
   if (L->stacksize > LUAI_MAXSTACK)  /* had been handling stack overflow? */
     luaE_freeCI(L);  /* free all CIs (list grew because of an error) */
   else
@@ -288,7 +336,7 @@ void luaD_shrinkstack (lua_State *L) {
   /* if thread is currently not handling a stack overflow and its
      good size is smaller than current size, shrink its stack */
   if (inuse <= (LUAI_MAXSTACK - EXTRA_STACK) &&
-      goodsize < L->stacksize)
+      (L->stacksize > LUAI_MAXSTACK || L->stacksize - goodsize > inuse))
     luaD_reallocstack(L, goodsize);
   else  /* don't change stack */
     condmovestack(L,{},{});  /* (change only for debugging) */
@@ -504,6 +552,7 @@ int luaD_precall (lua_State *L, StkId func, int nresults) {
       n = (*f)(L);  /* do the actual call - 直接调用C语言闭包函数 */
       lua_lock(L);
       api_checknelems(L, n);
+      luaR_checksample(L);  /* attribute pending sample to the C function */
       luaD_poscall(L, ci, L->top - n, n);  /* 调整堆栈 */
       return 1;  /* 返回1 C语言本身函数 */
     }
@@ -736,7 +785,9 @@ static void resume (lua_State *L, void *ud) {
 LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs) {
   int status;
   unsigned short oldnny = L->nny;  /* save "number of non-yieldable" calls */
+  lua_State *oldrunning;
   lua_lock(L);
+  oldrunning = G(L)->running;
   if (L->status == LUA_OK) {  /* may be starting a coroutine */
     if (L->ci != &L->base_ci)  /* not in base level? */
       return resume_error(L, "cannot resume non-suspended coroutine", nargs);
@@ -749,6 +800,7 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs) {
   luai_userstateresume(L, nargs);
   L->nny = 0;  /* allow yields */
   api_checknelems(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
+  G(L)->running = L;
   status = luaD_rawrunprotected(L, resume, &nargs);  /* 回调函数resume,入参L为线程栈 */
   if (status == -1)  /* error calling 'lua_resume'? */
     status = LUA_ERRRUN;
@@ -765,6 +817,7 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs) {
     else lua_assert(status == L->status);  /* normal end or yield */
   }
   L->nny = oldnny;  /* restore 'nny' */
+  G(L)->running = oldrunning;
   L->nCcalls--;
   lua_assert(L->nCcalls == ((from) ? from->nCcalls : 0));
   lua_unlock(L);
@@ -857,6 +910,7 @@ struct SParser {  /* data to 'f_parser' */
   Dyndata dyd;  /* dynamic structures used by the parser */
   const char *mode;
   const char *name;
+  ChunkImage **img;  /* image holding the whole chunk (or NULL) */
 };
 
 
@@ -875,7 +929,11 @@ static void f_parser (lua_State *L, void *ud) {
   int c = zgetc(p->z);  /* read first character */
   if (c == LUA_SIGNATURE[0]) {
     checkmode(L, p->mode, "binary");
-    cl = luaU_undump(L, p->z, p->name);
+    cl = luaU_undump(L, p->z, p->name, p->img);
+  }
+  else if (p->mode && strchr(p->mode, 'd') != NULL) {  /* data chunk? */
+    luaY_parsedata(L, p->z, &p->buff, p->name, c);
+    return;  /* closure is complete */
   }
   else {
     checkmode(L, p->mode, "text");  /* 文本类型,调用luaY_parser */
@@ -890,18 +948,20 @@ static void f_parser (lua_State *L, void *ud) {
 ** 文件解析函数(保护方式调用)
 */
 int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
-                                        const char *mode) {
+                                        const char *mode, ChunkImage **img) {
   struct SParser p;
   int status;
   L->nny++;  /* cannot yield during parsing */
-  p.z = z; p.name = name; p.mode = mode;
+  p.z = z; p.name = name; p.mode = mode; p.img = img;
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
+  p.dyd.cst.arr = NULL; p.dyd.cst.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
   luaZ_initbuffer(L, &p.buff);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
   luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
+  luaM_freearray(L, p.dyd.cst.arr, p.dyd.cst.size);
   luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
   luaM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
   L->nny--;
@@ -16,15 +16,24 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
 
+/* number of instructions converted at a time by 'DumpCode' */
+#if !defined(LUAI_DUMPCODEBUFF)
+#define LUAI_DUMPCODEBUFF	128
+#endif
+
+
 typedef struct {
   lua_State *L;
   lua_Writer writer;
   void *data;
   int strip;
+  int image;  /* dumping a chunk image? */
+  size_t offset;  /* bytes written so far */
   int status;
 } DumpState;
 
@@ -44,6 +53,19 @@ static void DumpBlock (const void *b, size_t size, DumpState *D) {
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
   }
+  D->offset += size;
+}
+
+
+/*
+** In a chunk image, pad the arrays that can be used in place (code
+** and line information) to a multiple of their element size 'align'
+** (see 'LoadAlign')
+*/
+static void DumpAlign (size_t align, DumpState *D) {
+  static const char zeros[sizeof(lua_Number)] = {0};
+  if (D->image && D->offset % align != 0)
+    DumpBlock(zeros, align - D->offset % align, D);
 }
 
 
@@ -88,9 +110,30 @@ static void DumpString (const TString *s, DumpState *D) {
 }
 
 
+/*
+** Code is saved in its generic form (see 'luaP_generic'), a block of
+** instructions at a time. Images, whose code is used as is, get it
+** already fused; each block has one more instruction to fuse the last
+** one.
+*/
 static void DumpCode (const Proto *f, DumpState *D) {
+  Instruction buff[LUAI_DUMPCODEBUFF + 1];
+  int pc = 0;
   DumpInt(f->sizecode, D);
-  DumpVector(f->code, f->sizecode, D);
+  DumpAlign(sizeof(Instruction), D);
+  while (pc < f->sizecode) {
+    int n = 0;
+    while (n <= LUAI_DUMPCODEBUFF && pc + n < f->sizecode) {
+      buff[n] = luaP_generic(f->code[pc + n]);
+      n++;
+    }
+    if (D->image)
+      luaP_fuse(buff, n);
+    if (n > LUAI_DUMPCODEBUFF)
+      n = LUAI_DUMPCODEBUFF;
+    DumpVector(buff, n, D);
+    pc += n;
+  }
 }
 
 
@@ -145,11 +188,51 @@ static void DumpUpvalues (const Proto *f, DumpState *D) {
 }
 
 
+/* number of bytes that 'DumpString' writes for 's' */
+static size_t StringSize (const TString *s) {
+  size_t size = (s == NULL) ? 0 : tsslen(s) + 1;
+  if (size == 0)
+    return 1;
+  else
+    return (size < 0xFF) ? size : size + sizeof(size_t);
+}
+
+
+/* number of bytes of the names written by 'DumpDebug' */
+static size_t NamesSize (const Proto *f, DumpState *D) {
+  size_t size = 2 * sizeof(int);
+  int i;
+  if (!D->strip) {
+    for (i = 0; i < f->sizelocvars; i++)
+      size += StringSize(f->locvars[i].varname) + 2 * sizeof(int);
+    for (i = 0; i < f->sizeupvalues; i++)
+      size += StringSize(f->upvalues[i].name);
+  }
+  return size;
+}
+
+
+/*
+** In a chunk image, the names of local variables and upvalues follow
+** their size (see 'LoadDebug')
+*/
 static void DumpDebug (const Proto *f, DumpState *D) {
   int i, n;
+  size_t size = 0;
   n = (D->strip) ? 0 : f->sizelineinfo;
   DumpInt(n, D);
   DumpVector(f->lineinfo, n, D);
+  n = (D->strip) ? 0 : f->sizeabslineinfo;
+  DumpInt(n, D);
+  DumpAlign(sizeof(int), D);
+  DumpVector(f->abslineinfo, n, D);
+  if (!D->strip)
+    luaU_needdebug(D->L, cast(Proto *, f));
+  if (D->image) {
+    size = NamesSize(f, D);
+    DumpVar(size, D);
+    size += D->offset;  /* where the names must end */
+  }
   n = (D->strip) ? 0 : f->sizelocvars;
   DumpInt(n, D);
   for (i = 0; i < n; i++) {
@@ -161,6 +244,7 @@ static void DumpDebug (const Proto *f, DumpState *D) {
   DumpInt(n, D);
   for (i = 0; i < n; i++)
     DumpString(f->upvalues[i].name, D);
+  lua_assert(!D->image || D->offset == size);
 }
 
 
@@ -185,7 +269,7 @@ static void DumpFunction (const Proto *f, TString *psource, DumpState *D) {
 static void DumpHeader (DumpState *D) {
   DumpLiteral(LUA_SIGNATURE, D);
   DumpByte(LUAC_VERSION, D);
-  DumpByte(LUAC_FORMAT, D);
+  DumpByte(D->image ? LUAC_IMAGEFORMAT : LUAC_FORMAT, D);
   DumpLiteral(LUAC_DATA, D);
   DumpByte(sizeof(int), D);
   DumpByte(sizeof(size_t), D);
@@ -198,15 +282,17 @@ static void DumpHeader (DumpState *D) {
 
 
 /*
-** dump Lua function as precompiled chunk
+** dump Lua function as precompiled chunk (or as a chunk image)
 */
 int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
-              int strip) {
+              int strip, int image) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
+  D.image = image;
+  D.offset = 0;
   D.status = 0;
   DumpHeader(&D);
   DumpByte(f->sizeupvalues, &D);
@@ -17,6 +17,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -106,9 +107,21 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->jit = NULL;
+  f->image = NULL;
+  f->debuginfo = 0;
+  f->jitcount = LUAI_JITHOT;
+#if defined(LUAI_OPSTATS)
+  f->hits = NULL;
+#endif
+#if !defined(LUAI_NOGCACHE)
+  f->gcache = NULL;
+#endif
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
+  f->abslineinfo = NULL;
+  f->sizeabslineinfo = 0;
   f->upvalues = NULL;
   f->sizeupvalues = 0;
   f->numparams = 0;
@@ -123,13 +136,56 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+#if !defined(LUAI_NOGCACHE)
+/*
+** Create the global cache of prototype 'f' (see 'OP_GETTABUP' in lvm.c)
+*/
+void luaF_newgcache (lua_State *L, Proto *f) {
+  GlobalCache *gc = luaM_newvector(L, f->sizek, GlobalCache);
+  int i;
+  for (i = 0; i < f->sizek; i++)
+    gc[i].t = NULL;
+  f->gcache = gc;
+}
+#endif
+
+
+/*
+** Drop a reference to chunk image 'img', releasing it with the last
+** one. (Called while freeing prototypes, so 'release' must not use
+** the Lua state.)
+*/
+void luaF_unrefimage (lua_State *L, ChunkImage *img) {
+  lua_assert(img->nref > 0);
+  if (--img->nref == 0) {
+    if (img->release)
+      (*img->release)(img->ud, img->buff, img->size);
+    luaM_free(L, img);
+  }
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  if (f->image == NULL) {
+    luaM_freearray(L, f->code, f->sizecode);
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+    luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
+  }
+  else  /* code and line information are in the image */
+    luaF_unrefimage(L, f->image);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  luaJ_free(L, f);
+#if defined(LUAI_OPSTATS)
+  if (f->hits != NULL)
+    luaM_freearray(L, f->hits, f->sizecode);
+#endif
+#if !defined(LUAI_NOGCACHE)
+  if (f->gcache != NULL)
+    luaM_freearray(L, f->gcache, f->sizek);
+#endif
   luaM_free(L, f);
 }
 
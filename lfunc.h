@@ -53,7 +53,11 @@ LUAI_FUNC LClosure *luaF_newLclosure (lua_State *L, int nelems);
 LUAI_FUNC void luaF_initupvals (lua_State *L, LClosure *cl);
 LUAI_FUNC UpVal *luaF_findupval (lua_State *L, StkId level);
 LUAI_FUNC void luaF_close (lua_State *L, StkId level);
+LUAI_FUNC void luaF_unrefimage (lua_State *L, ChunkImage *img);
 LUAI_FUNC void luaF_freeproto (lua_State *L, Proto *f);
+#if !defined(LUAI_NOGCACHE)
+LUAI_FUNC void luaF_newgcache (lua_State *L, Proto *f);
+#endif
 LUAI_FUNC const char *luaF_getlocalname (const Proto *func, int local_number,
                                          int pc);
 
@@ -12,6 +12,7 @@
 
 
 #include <string.h>
+#include <time.h>
 
 #include "lua.h"
 
@@ -21,6 +22,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -60,6 +62,23 @@
 #define PAUSEADJ		100
 
 
+/*
+** 'luai_gcclock()' gives the time (in seconds) used by the collector
+** telemetry
+*/
+#if !defined(luai_gcclock)
+#if defined(LUA_USE_POSIX) && defined(CLOCK_MONOTONIC)
+static double luai_gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+#else
+#define luai_gcclock()	((double)clock() / CLOCKS_PER_SEC)
+#endif
+#endif
+
+
 /*
 ** 'makewhite' erases all color bits then sets only the current white
 ** bit
@@ -213,6 +232,8 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
   o->tt = tt;
   o->next = g->allgc;
   g->allgc = o;
+  if (g->heapprof != NULL)
+    luaR_heapsample(L, o, sz);
   return o;
 }
 
@@ -294,6 +315,20 @@ static void markmt (global_State *g) {
 }
 
 
+/*
+** mark functions in samples of a profiler, which must be kept alive
+** for 'lua_profdump'/'lua_heapprofdump'
+*/
+static void markprofile (global_State *g, Profile *pf) {
+  int i;
+  if (pf == NULL) return;
+  for (i = 0; i < pf->nframes; i++) {
+    if (pf->frames[i].f != NULL && pf->frames[i].pc >= 0)
+      markobject(g, cast(Proto *, pf->frames[i].f));
+  }
+}
+
+
 /*
 ** mark all objects in list of being-finalized
 */
@@ -493,7 +528,8 @@ static int traverseproto (global_State *g, Proto *f) {
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
-                         sizeof(int) * f->sizelineinfo +
+                         sizeof(ls_byte) * f->sizelineinfo +
+                         sizeof(AbsLineInfo) * f->sizeabslineinfo +
                          sizeof(LocVar) * f->sizelocvars +
                          sizeof(Upvaldesc) * f->sizeupvalues;
 }
@@ -696,6 +732,8 @@ static void freeLclosure (lua_State *L, LClosure *cl) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
+  if (testbit(o->marked, SAMPLEDBIT))
+    luaR_heapfree(L, o);
   switch (o->tt) {
     case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
     case LUA_TLCL: {
@@ -815,6 +853,7 @@ static void GCTM (lua_State *L, int propagateerrors) {
     int status;
     lu_byte oldah = L->allowhook;
     int running  = g->gcrunning;
+    g->gcstats.finalizers++;
     L->allowhook = 0;  /* stop debug hooks during GC metamethod */
     g->gcrunning = 0;  /* avoid GC steps */
     setobj2s(L, L->top, tm);  /* push finalizer... */
@@ -925,6 +964,60 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
 
 
 
+/*
+** {======================================================
+** Telemetry
+** =======================================================
+*/
+
+/* fill 's' with the statistics of the collector and its current state */
+void luaC_getstats (global_State *g, lua_GCStats *s) {
+  *s = g->gcstats;
+  s->estimate = g->GCestimate;
+  s->totalbytes = gettotalbytes(g);
+  s->debt = g->GCdebt;
+  s->state = g->gcstate;
+}
+
+
+static void callgcevent (lua_State *L, int event) {
+  global_State *g = G(L);
+  if (g->gccallback != NULL) {
+    lua_GCStats s;
+    luaC_getstats(g, &s);
+    (*g->gccallback)(L, event, &s, g->gcud);
+  }
+}
+
+
+/* charge the time since '*last' to state 'st' */
+static void chargetime (global_State *g, int st, double *last) {
+  double now = luai_gcclock();
+  double t = now - *last;
+  g->gcstats.time[st] += t;
+  if (st == GCSatomic) {  /* a whole atomic step */
+    g->gcstats.lastatomic = t;
+    if (t > g->gcstats.maxatomic) g->gcstats.maxatomic = t;
+  }
+  *last = now;
+}
+
+
+/* add a step that ran from 'start' to 'end' to the histogram */
+static void countstep (global_State *g, double start, double end) {
+  double us = (end - start) * 1e6;  /* microseconds */
+  int i = 0;
+  while (us >= 1.0 && i < LUA_GCHISTSIZE - 1) {
+    us /= 2;
+    i++;
+  }
+  g->gcstats.steptimes[i]++;
+  g->gcstats.steps++;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** GC control
@@ -945,6 +1038,10 @@ static void setpause (global_State *g) {
   threshold = (g->gcpause < MAX_LMEM / estimate)  /* overflow? */
             ? estimate * g->gcpause  /* no overflow */
             : MAX_LMEM;  /* overflow; truncate to maximum */
+  if (cast(lu_mem, threshold) > g->GCsoftlimit)  /* beyond soft limit? */
+    threshold = (g->GCestimate < g->GCsoftlimit)
+              ? cast(l_mem, g->GCsoftlimit)  /* start cycle at the limit */
+              : cast(l_mem, g->GCestimate);  /* or right away */
   debt = gettotalbytes(g) - threshold;
   luaE_setdebt(g, debt);
 }
@@ -993,6 +1090,8 @@ static l_mem atomic (lua_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  markprofile(g, g->profile);  /* mark functions in profiler samples */
+  markprofile(g, g->heapprof);
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
   propagateall(g);  /* propagate changes */
@@ -1033,6 +1132,7 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
     l_mem olddebt = g->GCdebt;
     g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+    g->gcstats.swept += cast(size_t, olddebt - g->GCdebt);
     if (g->sweepgc)  /* is there still something to sweep? */
       return (GCSWEEPMAX * GCSWEEPCOST);
   }
@@ -1050,6 +1150,7 @@ static lu_mem singlestep (lua_State *L) {
       g->GCmemtrav = g->strt.size * sizeof(GCObject*);
       restartcollection(g);
       g->gcstate = GCSpropagate;
+      callgcevent(L, LUA_GCEVSTART);
       return g->GCmemtrav;
     }
     case GCSpropagate: {
@@ -1058,12 +1159,14 @@ static lu_mem singlestep (lua_State *L) {
       propagatemark(g);
        if (g->gray == NULL)  /* no more gray objects? */
         g->gcstate = GCSatomic;  /* finish propagate phase */
+      g->gcstats.traversed += g->GCmemtrav;
       return g->GCmemtrav;  /* memory traversed in this step */
     }
     case GCSatomic: {
       lu_mem work;
       propagateall(g);  /* make sure gray list is empty */
       work = atomic(L);  /* work is what was traversed by 'atomic' */
+      g->gcstats.traversed += work;
       entersweep(L);
       g->GCestimate = gettotalbytes(g);  /* first estimate */;
       return work;
@@ -1090,6 +1193,8 @@ static lu_mem singlestep (lua_State *L) {
       }
       else {  /* emergency mode or no more finalizers */
         g->gcstate = GCSpause;  /* finish collection */
+        g->gcstats.cycles++;
+        callgcevent(L, LUA_GCEVEND);
         return 0;
       }
     }
@@ -1104,8 +1209,25 @@ static lu_mem singlestep (lua_State *L) {
 */
 void luaC_runtilstate (lua_State *L, int statesmask) {
   global_State *g = G(L);
-  while (!testbit(statesmask, g->gcstate))
+  double last = luai_gcclock();
+  while (!testbit(statesmask, g->gcstate)) {
+    int st = g->gcstate;
     singlestep(L);
+    if (g->gcstate != st)
+      chargetime(g, st, &last);
+  }
+}
+
+
+/*
+** 'stepmul' in use: above the soft limit, the collector works twice
+** as fast
+*/
+static int getstepmul (global_State *g) {
+  if (gettotalbytes(g) > g->GCsoftlimit && g->gcstepmul < MAX_INT / 2)
+    return g->gcstepmul * 2;
+  else
+    return g->gcstepmul;
 }
 
 
@@ -1113,9 +1235,8 @@ void luaC_runtilstate (lua_State *L, int statesmask) {
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
 */
-static l_mem getdebt (global_State *g) {
+static l_mem getdebt (global_State *g, int stepmul) {
   l_mem debt = g->GCdebt;
-  int stepmul = g->gcstepmul;
   if (debt <= 0) return 0;  /* minimal debt */
   else {
     debt = (debt / STEPMULADJ) + 1;
@@ -1129,22 +1250,31 @@ static l_mem getdebt (global_State *g) {
 */
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
-  l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
+  int stepmul = getstepmul(g);
+  l_mem debt = getdebt(g, stepmul);  /* GC deficit (be paid now) */
+  double start, last;
   if (!g->gcrunning) {  /* not running? */
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  start = last = luai_gcclock();
   do {  /* repeat until pause or enough "credit" (negative debt) */
+    int st = g->gcstate;
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
+    if (g->gcstate != st)
+      chargetime(g, st, &last);
   } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause);
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
   else {
-    debt = (debt / g->gcstepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
+    debt = (debt / stepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
     luaE_setdebt(g, debt);
+    chargetime(g, g->gcstate, &last);
     runafewfinalizers(L);
+    chargetime(g, GCScallfin, &last);  /* finalizers of previous cycle */
   }
+  countstep(g, start, last);
 }
 
 
@@ -1159,6 +1289,7 @@ void luaC_step (lua_State *L) {
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
+  double start = luai_gcclock();
   lua_assert(g->gckind == KGC_NORMAL);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
   if (keepinvariant(g)) {  /* black objects? */
@@ -1173,6 +1304,7 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
   g->gckind = KGC_NORMAL;
   setpause(g);
+  countstep(g, start, luai_gcclock());
 }
 
 /* }====================================================== */
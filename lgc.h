@@ -34,7 +34,8 @@
 
 
 /*
-** Possible states of the Garbage Collector
+** Possible states of the Garbage Collector (their order is exposed by
+** 'lua_GCStats')
 */
 #define GCSpropagate	0
 #define GCSatomic	1
@@ -79,6 +80,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define SAMPLEDBIT	4  /* object was sampled by the heap profiler */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -142,6 +144,7 @@ LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
 LUAI_FUNC void luaC_upvalbarrier_ (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount (lua_State *L, UpVal *uv);
+LUAI_FUNC void luaC_getstats (global_State *g, lua_GCStats *s);
 
 
 #endif
@@ -0,0 +1,1575 @@
+/*
+** $Id: ljit.c $
+** Baseline compiler from Lua bytecode to native code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS with glibc */
+#endif
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "lvm.h"
+
+
+#if defined(LUAJ_ENABLED)	/* { */
+
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+
+/*
+** The compiler translates each instruction of a hot function into a
+** fixed template of x86-64 code. Templates handle the common cases
+** inline and call back into the VM ('luaV_finishget', 'luaO_arith',
+** 'luaD_precall', etc.) for the others. Instructions without a
+** template, and some failed type guards, 'exit' to the interpreter,
+** which resumes at 'ci->u.l.savedpc'. Before any call that may raise
+** an error or run a hook, native code sets 'savedpc' as the
+** interpreter would, so errors and the debug interface see the same
+** state in both cases.
+**
+** The interpreter switches to native code when a frame (re)starts and
+** at loop back edges (see 'luaV_execute'), but only at 'entry points':
+** the function start, the return point of each call, and loop heads.
+** A type analysis finds the tags that registers surely have between
+** entry points, so that templates can drop the corresponding guards;
+** every entry point starts with unknown types, except the head of an
+** integer loop, entered only when its control variable is an integer.
+** Native code checks for line and count hooks (and profiler sample
+** requests) after each call back into the VM and at its own back
+** edges, leaving for the interpreter when they are on.
+**
+** Register usage in native code (all callee-saved in the SysV ABI):
+** rbx = L; r12 = ci; r13 = base; r14 = k; r15 = closure.
+**
+** Code memory is mmap'ed for each function and is not counted by
+** the garbage collector.
+*/
+
+
+typedef struct JitCode {
+  size_t size;  /* size of the whole block */
+  lu_byte *mcode;  /* machine code (starting with the entry sequence) */
+  unsigned int *entry;  /* entry points (see 'luaJ_run') */
+  unsigned int pcoff[1];  /* offset in 'mcode' of each instruction */
+} JitCode;
+
+
+/* entry sequence: run native code of frame 'ci' starting at 'start' */
+typedef int (*JitEntry) (lua_State *L, CallInfo *ci, const lu_byte *start);
+
+
+/* x86-64 registers */
+#define rAX	0
+#define rCX	1
+#define rDX	2
+#define rBX	3
+#define rSP	4
+#define rBP	5
+#define rSI	6
+#define rDI	7
+#define r8	8
+#define r12	12
+#define r13	13
+#define r14	14
+#define r15	15
+
+#define rL	rBX
+#define rCI	r12
+#define rBASE	r13
+#define rK	r14
+#define rCL	r15
+
+
+/* condition codes */
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_NS	0x9
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+#define CC_JMP	(-1)	/* unconditional jump */
+
+#define negcc(cc)	((cc) ^ 1)
+
+
+/* some x86 opcodes */
+#define X_ADD	0x03
+#define X_OR	0x0B
+#define X_AND	0x23
+#define X_SUB	0x2B
+#define X_XOR	0x33
+#define X_CMP	0x3B
+#define X_IMUL	0x0FAF
+#define X_ADDSD	0x0F58
+#define X_MULSD	0x0F59
+#define X_SUBSD	0x0F5C
+#define X_DIVSD	0x0F5E
+
+/* pseudo-opcodes for integer division (see 'intdiv') */
+#define X_MOD	0x10000
+#define X_IDIV	0x10001
+
+
+#define fieldof(t,f)	cast_int(offsetof(t, f))
+#define TVSIZE		cast_int(sizeof(TValue))
+#define TTOFF		fieldof(TValue, tt_)
+
+#define fptr(f)		cast(size_t, (f))
+
+
+/*
+** Operands are registers (0 .. MAXARG_A) or constants, coded as
+** negative numbers.
+*/
+#define opk(k)		(-1 - (k))
+#define isopk(o)	((o) < 0)
+#define opkindex(o)	(-1 - (o))
+#define oprk(rk)	(ISK(rk) ? opk(INDEXK(rk)) : (rk))
+
+#define opbase(o)	(isopk(o) ? rK : rBASE)
+#define opdisp(o)	((isopk(o) ? opkindex(o) : (o)) * TVSIZE)
+
+
+#define MAXJUMPS	8
+
+/* list of forward jumps to the same (yet unknown) place */
+typedef struct JumpList {
+  int n;
+  size_t pos[MAXJUMPS];
+} JumpList;
+
+
+/* kinds of entry points */
+#define EK_NONE		0
+#define EK_ANY		1	/* any state */
+#define EK_LOOP		2	/* head of a loop with integer control */
+
+#define TY_UNK		0xFF	/* unknown tag in a type state */
+
+
+typedef struct JitState {
+  Proto *p;
+  lu_byte *mcode;  /* code buffer ('NULL' while only sizing code) */
+  unsigned int *pcoff;  /* instruction offsets ('NULL' in first pass) */
+  unsigned int *entry;  /* entry points ('NULL' in first pass) */
+  lu_byte *ekind;  /* kind of entry point of each instruction */
+  lu_byte *types;  /* type state before each instruction, or 'NULL' */
+  const lu_byte *ty;  /* type state of current instruction, or 'NULL' */
+  size_t pos;  /* current position in code */
+  size_t exit0;  /* offset of exit sequence returning 0 */
+  size_t exit1;  /* offset of exit sequence returning 1 */
+  int pc;  /* instruction being compiled */
+  JumpList slow;  /* jumps to the exit of current instruction */
+} JitState;
+
+
+
+/*
+** {======================================================
+** Code emission
+** =======================================================
+*/
+
+static void eb (JitState *J, unsigned int b) {
+  if (J->mcode)
+    J->mcode[J->pos] = cast_byte(b & 0xff);
+  J->pos++;
+}
+
+
+static void e32 (JitState *J, unsigned int w) {
+  int n;
+  for (n = 0; n < 4; n++, w >>= 8)
+    eb(J, w & 0xff);
+}
+
+
+static void e64 (JitState *J, size_t w) {
+  e32(J, cast(unsigned int, w & 0xffffffffu));
+  e32(J, cast(unsigned int, w >> 32));
+}
+
+
+/*
+** Emit instruction 'op' (one or two opcode bytes, after an optional
+** mandatory prefix 'pre') with register operand 'r' and memory operand
+** '[b + d]'; 'w' selects 64-bit operands. Displacements are always 32
+** bits, so that the size of a template does not depend on operands.
+*/
+static void emitm (JitState *J, int pre, int w, unsigned int op,
+                   int r, int b, int d) {
+  int rex = 0x40 | (w << 3) | ((r & 8) >> 1) | ((b & 8) >> 3);
+  if (pre) eb(J, pre);
+  if (rex != 0x40) eb(J, rex);
+  if (op > 0xff) eb(J, op >> 8);
+  eb(J, op);
+  eb(J, 0x80 | ((r & 7) << 3) | (b & 7));  /* mod 10: [b + disp32] */
+  if ((b & 7) == rSP) eb(J, 0x24);  /* rsp and r12 need a SIB byte */
+  e32(J, cast(unsigned int, d));
+}
+
+
+/* same as 'emitm' with a register 'm' instead of a memory operand */
+static void emitr (JitState *J, int pre, int w, unsigned int op,
+                   int r, int m) {
+  int rex = 0x40 | (w << 3) | ((r & 8) >> 1) | ((m & 8) >> 3);
+  if (pre) eb(J, pre);
+  if (rex != 0x40) eb(J, rex);
+  if (op > 0xff) eb(J, op >> 8);
+  eb(J, op);
+  eb(J, 0xC0 | ((r & 7) << 3) | (m & 7));
+}
+
+
+#define ld(J,r,b,d)	emitm(J, 0, 1, 0x8B, r, b, d)  /* mov r, [b+d] */
+#define st(J,r,b,d)	emitm(J, 0, 1, 0x89, r, b, d)  /* mov [b+d], r */
+#define ld32(J,r,b,d)	emitm(J, 0, 0, 0x8B, r, b, d)
+#define lea(J,r,b,d)	emitm(J, 0, 1, 0x8D, r, b, d)
+#define alu(J,op,r,b,d)	emitm(J, 0, 1, op, r, b, d)  /* r op= [b+d] */
+#define mov(J,r,m)	emitr(J, 0, 1, 0x89, m, r)  /* mov r, m */
+#define ldv(J,b,d)	emitm(J, 0, 0, 0x0F10, 0, b, d)  /* movups xmm0, */
+#define stv(J,b,d)	emitm(J, 0, 0, 0x0F11, 0, b, d)  /* movups ..., xmm0 */
+#define ldsd(J,x,b,d)	emitm(J, 0xF2, 0, 0x0F10, x, b, d)
+#define stsd(J,x,b,d)	emitm(J, 0xF2, 0, 0x0F11, x, b, d)
+#define sse(J,op,x,b,d)	emitm(J, 0xF2, 0, op, x, b, d)
+#define ucomisd(J,x,b,d)	emitm(J, 0x66, 0, 0x0F2E, x, b, d)
+#define ucomisdr(J,x,y)	emitr(J, 0x66, 0, 0x0F2E, x, y)
+#define cvtsi2sd(J,x,r)	emitr(J, 0xF2, 1, 0x0F2A, x, r)
+
+
+/* mov dword [b+d], imm */
+static void stimm (JitState *J, int b, int d, int imm) {
+  emitm(J, 0, 0, 0xC7, 0, b, d);
+  e32(J, cast(unsigned int, imm));
+}
+
+
+/* cmp [b+d], imm (qword if 'w', else dword) */
+static void cmpimm (JitState *J, int w, int b, int d, int imm) {
+  emitm(J, 0, w, 0x81, 7, b, d);
+  e32(J, cast(unsigned int, imm));
+}
+
+
+/* test dword [b+d], imm */
+static void testimm (JitState *J, int b, int d, int imm) {
+  emitm(J, 0, 0, 0xF7, 0, b, d);
+  e32(J, cast(unsigned int, imm));
+}
+
+
+/* 'op' r, imm (opcode extension 'ext' of group 0x81) */
+static void aluimm (JitState *J, int ext, int r, int imm) {
+  emitr(J, 0, 1, 0x81, ext, r);
+  e32(J, cast(unsigned int, imm));
+}
+
+
+/* mov r, imm64 */
+static void movimm (JitState *J, int r, size_t v) {
+  eb(J, 0x48 | ((r & 8) >> 3));
+  eb(J, 0xB8 | (r & 7));
+  e64(J, v);
+}
+
+
+/* mov r32, imm32 (only for argument registers) */
+static void movimm32 (JitState *J, int r, int v) {
+  lua_assert(r < 8);
+  eb(J, 0xB8 | r);
+  e32(J, cast(unsigned int, v));
+}
+
+
+static void push (JitState *J, int r) {
+  if (r & 8) eb(J, 0x41);
+  eb(J, 0x50 | (r & 7));
+}
+
+
+static void pop (JitState *J, int r) {
+  if (r & 8) eb(J, 0x41);
+  eb(J, 0x58 | (r & 7));
+}
+
+
+/*
+** Emit a jump to offset 'target' (conditional unless 'cc' is CC_JMP).
+** Returns the position after it, which identifies the jump for
+** 'patch'.
+*/
+static size_t jump (JitState *J, int cc, size_t target) {
+  if (cc == CC_JMP)
+    eb(J, 0xE9);
+  else {
+    eb(J, 0x0F);
+    eb(J, 0x80 | cc);
+  }
+  e32(J, cast(unsigned int, target - (J->pos + 4)));
+  return J->pos;
+}
+
+
+/* jump to instruction 'pc' */
+static void jumppc (JitState *J, int cc, int pc) {
+  lua_assert(0 <= pc && pc < J->p->sizecode);
+  jump(J, cc, (J->mcode != NULL) ? J->pcoff[pc] : 0);
+}
+
+
+/* fix forward jump 'j' to go to current position */
+static void patch (JitState *J, size_t j) {
+  if (J->mcode) {
+    unsigned int rel = cast(unsigned int, J->pos - j);
+    int n;
+    for (n = 0; n < 4; n++, rel >>= 8)
+      J->mcode[j - 4 + n] = cast_byte(rel & 0xff);
+  }
+}
+
+
+static void tolist (JumpList *l, size_t j) {
+  lua_assert(l->n < MAXJUMPS);
+  l->pos[l->n++] = j;
+}
+
+
+static void patchlist (JitState *J, JumpList *l) {
+  int n;
+  for (n = 0; n < l->n; n++)
+    patch(J, l->pos[n]);
+  l->n = 0;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Template helpers
+** =======================================================
+*/
+
+/* ci->u.l.savedpc = &p->code[pc] */
+static void savepc (JitState *J, int pc) {
+  movimm(J, rAX, cast(size_t, J->p->code + pc));
+  st(J, rAX, rCI, fieldof(CallInfo, u.l.savedpc));
+}
+
+
+/* leave native code, to resume interpretation at instruction 'pc' */
+static void exitat (JitState *J, int pc) {
+  savepc(J, pc);
+  jump(J, CC_JMP, J->exit0);
+}
+
+
+/*
+** Leave for the interpreter to execute the current instruction if
+** condition 'cc' holds (always if 'cc' is CC_JMP).
+*/
+static void slowif (JitState *J, int cc) {
+  tolist(&J->slow, jump(J, cc, 0));
+}
+
+
+/*
+** Call VM function 'f' with arguments already in place ('rdi' gets
+** 'L'). 'savedpc' must already point to the next instruction. As the
+** call can run arbitrary code, reload 'base' after it and leave for
+** the interpreter if a hook was set. If 'checkret', a non-zero result
+** means the function pushed a new Lua frame for the interpreter to run.
+*/
+static void callvm (JitState *J, size_t f, int checkret) {
+  mov(J, rDI, rL);
+  movimm(J, rAX, f);
+  emitr(J, 0, 0, 0xFF, 2, rAX);  /* call rax */
+  if (checkret) {
+    emitr(J, 0, 0, 0x85, rAX, rAX);  /* test eax, eax */
+    jump(J, CC_NE, J->exit1);
+  }
+  ld(J, rBASE, rCI, fieldof(CallInfo, u.l.base));
+  testimm(J, rL, fieldof(lua_State, hookmask), TRACEMASK);
+  jump(J, CC_NE, J->exit0);
+}
+
+
+/* jump back to instruction 'pc', unless hooks need the interpreter */
+static void backedge (JitState *J, int pc) {
+  testimm(J, rL, fieldof(lua_State, hookmask), TRACEMASK);
+  jumppc(J, CC_E, pc);
+  exitat(J, pc);
+}
+
+
+/* tag of constant operand 'o', -1 for registers */
+static int ktag (JitState *J, int o) {
+  return isopk(o) ? rttype(&J->p->k[opkindex(o)]) : -1;
+}
+
+
+/* tag that operand 'o' surely has before current instruction, or -1 */
+static int knowntag (JitState *J, int o) {
+  if (isopk(o))
+    return ktag(J, o);
+  else if (J->ty != NULL && J->ty[o] != TY_UNK)
+    return J->ty[o];
+  else
+    return -1;
+}
+
+
+/*
+** Add to 'fail' a jump taken when operand 'o' does not have tag 't'.
+** Known tags are checked at compile time.
+*/
+static void guardtag (JitState *J, int o, int t, JumpList *fail) {
+  int kt = knowntag(J, o);
+  if (kt < 0) {
+    cmpimm(J, 0, opbase(o), opdisp(o) + TTOFF, t);
+    tolist(fail, jump(J, CC_NE, 0));
+  }
+  else if (kt != t)
+    tolist(fail, jump(J, CC_JMP, 0));
+}
+
+
+/* add to 'yes' jumps taken when register 'r' is false or nil */
+static void checkfalse (JitState *J, int r, JumpList *yes) {
+  int kt = knowntag(J, r);
+  size_t notbool = 0;
+  if (kt == LUA_TNIL)
+    tolist(yes, jump(J, CC_JMP, 0));
+  if (kt >= 0 && kt != LUA_TBOOLEAN)
+    return;  /* never false or always false */
+  if (kt < 0) {
+    cmpimm(J, 0, rBASE, r * TVSIZE + TTOFF, LUA_TNIL);
+    tolist(yes, jump(J, CC_E, 0));
+    cmpimm(J, 0, rBASE, r * TVSIZE + TTOFF, LUA_TBOOLEAN);
+    notbool = jump(J, CC_NE, 0);
+  }
+  cmpimm(J, 0, rBASE, r * TVSIZE, 0);
+  tolist(yes, jump(J, CC_E, 0));
+  if (notbool) patch(J, notbool);
+}
+
+
+/* R(a) := R(b) */
+static void copyreg (JitState *J, int a, int b) {
+  ldv(J, rBASE, b * TVSIZE);
+  stv(J, rBASE, a * TVSIZE);
+}
+
+
+/*
+** Compare-and-jump instructions are always followed by a JMP; flags
+** hold the comparison, 'cc' tells when it is true. If the result is
+** different from 'a', skip the JMP; otherwise, go execute it.
+*/
+static void condjump (JitState *J, int cc, int a) {
+  jumppc(J, a ? negcc(cc) : cc, J->pc + 2);
+  jumppc(J, CC_JMP, J->pc + 1);
+}
+
+
+/* instruction to go to when a comparison result is 'cond' */
+static int condtarget (JitState *J, int cond, int a) {
+  return (cond != a) ? J->pc + 2 : J->pc + 1;
+}
+
+
+/*
+** Load into 'rax' the address of the array slot of the table at
+** '[tb + td]' for integer key 'okey', jumping to 'fail' if it is not
+** there. Uses 'rcx' and 'rdx'.
+*/
+static void arrayslot (JitState *J, int tb, int td, int okey,
+                       JumpList *fail) {
+  guardtag(J, okey, LUA_TNUMINT, fail);
+  ld(J, rCX, tb, td);
+  ld(J, rAX, opbase(okey), opdisp(okey));
+  aluimm(J, 5, rAX, 1);  /* sub rax, 1 */
+  ld32(J, rDX, rCX, fieldof(Table, sizearray));
+  emitr(J, 0, 1, 0x39, rDX, rAX);  /* cmp rax, rdx */
+  tolist(fail, jump(J, CC_AE, 0));  /* unsigned: also catches key < 1 */
+  emitr(J, 0, 1, 0x69, rAX, rAX);  /* imul rax, rax, TVSIZE */
+  e32(J, TVSIZE);
+  alu(J, X_ADD, rAX, rCX, fieldof(Table, array));
+}
+
+
+/*
+** Load into 'rax' the address of the node of the table at '[tb + td]'
+** with short-string key 'key' (its value is the node's first field),
+** jumping to 'fail' if there is no such node. Walks the collision
+** chain as 'luaH_getshortstr' does. Uses 'rcx' and 'rdx'.
+*/
+static void hashslot (JitState *J, int tb, int td, TString *key,
+                      JumpList *fail) {
+  size_t loop, next, found;
+  lua_assert(fieldof(Node, i_val) == 0);
+  ld(J, rDX, tb, td);
+  emitm(J, 0, 0, 0x0FB6, rCX, rDX, fieldof(Table, lsizenode));  /* movzx */
+  movimm32(J, rAX, 1);
+  emitr(J, 0, 0, 0xD3, 4, rAX);  /* shl eax, cl */
+  aluimm(J, 5, rAX, 1);  /* sub rax, 1 */
+  aluimm(J, 4, rAX, cast_int(key->hash));  /* and rax, hash */
+  emitr(J, 0, 1, 0x69, rAX, rAX);  /* imul rax, rax, sizeof(Node) */
+  e32(J, cast(unsigned int, sizeof(Node)));
+  alu(J, X_ADD, rAX, rDX, fieldof(Table, node));
+  loop = J->pos;
+  cmpimm(J, 0, rAX, fieldof(Node, i_key.nk.tt_), ctb(LUA_TSHRSTR));
+  next = jump(J, CC_NE, 0);
+  movimm(J, rCX, cast(size_t, key));
+  alu(J, X_CMP, rCX, rAX, fieldof(Node, i_key.nk.value_));
+  found = jump(J, CC_E, 0);
+  patch(J, next);
+  emitm(J, 0, 1, 0x63, rCX, rAX, fieldof(Node, i_key.nk.next));  /* movsxd */
+  emitr(J, 0, 1, 0x85, rCX, rCX);  /* test rcx, rcx */
+  tolist(fail, jump(J, CC_E, 0));  /* end of chain */
+  emitr(J, 0, 1, 0x69, rCX, rCX);  /* imul rcx, rcx, sizeof(Node) */
+  e32(J, cast(unsigned int, sizeof(Node)));
+  emitr(J, 0, 1, 0x01, rCX, rAX);  /* add rax, rcx */
+  jump(J, CC_JMP, loop);
+  patch(J, found);
+}
+
+
+/*
+** Load into 'rax' the address of the value for key 'okey' in the table
+** at '[tb + td]': array slots for integer keys, hash nodes for constant
+** short strings. Jumps to 'fail' if the operand is not a table or the
+** value is absent or nil (it may need a metamethod). Returns 0 if keys
+** of this type have no fast path.
+*/
+static int tableslot (JitState *J, int tb, int td, int okey,
+                      JumpList *fail) {
+  int kt = knowntag(J, okey);
+  int isstr = (ktag(J, okey) == ctb(LUA_TSHRSTR));
+  if (!isstr && kt >= 0 && kt != LUA_TNUMINT)
+    return 0;
+  cmpimm(J, 0, tb, td + TTOFF, ctb(LUA_TTABLE));
+  tolist(fail, jump(J, CC_NE, 0));
+  if (isstr)
+    hashslot(J, tb, td, tsvalue(&J->p->k[opkindex(okey)]), fail);
+  else
+    arrayslot(J, tb, td, okey, fail);
+  cmpimm(J, 0, rAX, TTOFF, LUA_TNIL);
+  tolist(fail, jump(J, CC_E, 0));
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** VM entries called from native code
+** =======================================================
+*/
+
+static void j_gettable (lua_State *L, const TValue *t, TValue *key,
+                        StkId ra) {
+  luaV_gettable(L, t, key, ra);
+}
+
+
+static void j_settable (lua_State *L, const TValue *t, TValue *key,
+                        TValue *val) {
+  luaV_settable(L, t, key, val);
+}
+
+
+static void j_self (lua_State *L, StkId ra, StkId rb, TValue *key) {
+  setobjs2s(L, ra + 1, rb);
+  luaV_gettable(L, rb, key, ra);
+}
+
+
+static void j_setupval (lua_State *L, UpVal *uv, StkId ra) {
+  setobj(L, uv->v, ra);
+  luaC_upvalbarrier(L, uv);
+}
+
+
+static int j_call (lua_State *L, StkId ra, int b, int nresults) {
+  if (b != 0) L->top = ra + b;  /* else previous instruction set top */
+  if (luaD_precall(L, ra, nresults)) {  /* C function? */
+    if (nresults >= 0)
+      L->top = L->ci->top;  /* adjust results */
+    return 0;
+  }
+  else
+    return 1;  /* Lua function: interpreter runs its new frame */
+}
+
+
+static void j_tforcall (lua_State *L, StkId ra, int nresults) {
+  StkId cb = ra + 3;  /* call base */
+  setobjs2s(L, cb + 2, ra + 2);
+  setobjs2s(L, cb + 1, ra + 1);
+  setobjs2s(L, cb, ra);
+  L->top = cb + 3;  /* func. + 2 args (state and index) */
+  luaD_call(L, cb, nresults);
+  L->top = L->ci->top;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+/*
+** rax := R(ob) // R(oc) or R(ob) % R(oc) for integers, rounding as
+** 'luaV_div' and 'luaV_mod'. Divisors 0 and -1 go to 'slow'.
+*/
+static void intdiv (JitState *J, int ob, int oc, int mod, JumpList *slow) {
+  size_t exact, samesign;
+  ld(J, rCX, opbase(oc), opdisp(oc));
+  lea(J, rAX, rCX, 1);
+  aluimm(J, 7, rAX, 1);  /* cmp rax, 1 */
+  tolist(slow, jump(J, CC_BE, 0));  /* unsigned 'rcx + 1 <= 1' */
+  ld(J, rAX, opbase(ob), opdisp(ob));
+  eb(J, 0x48); eb(J, 0x99);  /* cqo */
+  emitr(J, 0, 1, 0xF7, 7, rCX);  /* idiv rcx */
+  emitr(J, 0, 1, 0x85, rDX, rDX);  /* test rdx, rdx */
+  exact = jump(J, CC_E, 0);
+  if (mod) {  /* result must have the sign of the divisor */
+    mov(J, rSI, rDX);
+    emitr(J, 0, 1, 0x31, rCX, rSI);  /* xor rsi, rcx */
+    samesign = jump(J, CC_NS, 0);
+    emitr(J, 0, 1, 0x01, rCX, rDX);  /* add rdx, rcx */
+  }
+  else {  /* quotient must be rounded towards minus infinity */
+    ld(J, rSI, opbase(ob), opdisp(ob));
+    emitr(J, 0, 1, 0x31, rCX, rSI);  /* xor rsi, rcx */
+    samesign = jump(J, CC_NS, 0);
+    aluimm(J, 5, rAX, 1);  /* sub rax, 1 */
+  }
+  patch(J, exact);
+  patch(J, samesign);
+  if (mod) mov(J, rAX, rDX);
+}
+
+
+/*
+** Arithmetic: integer ('iop') and float ('fop') fast paths when they
+** exist, and 'luaO_arith' (coercions and metamethods) otherwise.
+*/
+static void t_arith (JitState *J, int a, int ob, int oc, int op,
+                     unsigned int iop, unsigned int fop) {
+  JumpList notint, slow, done;
+  notint.n = slow.n = done.n = 0;
+  if (iop) {
+    guardtag(J, ob, LUA_TNUMINT, &notint);
+    guardtag(J, oc, LUA_TNUMINT, &notint);
+    if (iop == X_MOD || iop == X_IDIV)
+      intdiv(J, ob, oc, iop == X_MOD, &slow);
+    else {
+      ld(J, rAX, opbase(ob), opdisp(ob));
+      alu(J, iop, rAX, opbase(oc), opdisp(oc));
+    }
+    st(J, rAX, rBASE, a * TVSIZE);
+    stimm(J, rBASE, a * TVSIZE + TTOFF, LUA_TNUMINT);
+    tolist(&done, jump(J, CC_JMP, 0));
+  }
+  patchlist(J, &notint);
+  if (fop) {
+    guardtag(J, ob, LUA_TNUMFLT, &slow);
+    guardtag(J, oc, LUA_TNUMFLT, &slow);
+    ldsd(J, 0, opbase(ob), opdisp(ob));
+    sse(J, fop, 0, opbase(oc), opdisp(oc));
+    stsd(J, 0, rBASE, a * TVSIZE);
+    stimm(J, rBASE, a * TVSIZE + TTOFF, LUA_TNUMFLT);
+    tolist(&done, jump(J, CC_JMP, 0));
+  }
+  patchlist(J, &slow);
+  savepc(J, J->pc + 1);
+  movimm32(J, rSI, op);
+  lea(J, rDX, opbase(ob), opdisp(ob));
+  lea(J, rCX, opbase(oc), opdisp(oc));
+  lea(J, r8, rBASE, a * TVSIZE);
+  callvm(J, fptr(luaO_arith), 0);
+  patchlist(J, &done);
+}
+
+
+/* R(a) := R(b) + sc; non-numbers go to the interpreter */
+static void t_addi (JitState *J, int a, int b, int sc) {
+  JumpList notint;
+  size_t done;
+  notint.n = 0;
+  guardtag(J, b, LUA_TNUMINT, &notint);
+  ld(J, rAX, rBASE, b * TVSIZE);
+  aluimm(J, 0, rAX, sc);  /* add rax, sc */
+  st(J, rAX, rBASE, a * TVSIZE);
+  stimm(J, rBASE, a * TVSIZE + TTOFF, LUA_TNUMINT);
+  done = jump(J, CC_JMP, 0);
+  patchlist(J, &notint);
+  guardtag(J, b, LUA_TNUMFLT, &J->slow);
+  movimm(J, rAX, cast(size_t, cast(lua_Integer, sc)));
+  cvtsi2sd(J, 1, rAX);
+  ldsd(J, 0, rBASE, b * TVSIZE);
+  emitr(J, 0xF2, 0, X_ADDSD, 0, 1);  /* addsd xmm0, xmm1 */
+  stsd(J, 0, rBASE, a * TVSIZE);
+  stimm(J, rBASE, a * TVSIZE + TTOFF, LUA_TNUMFLT);
+  patch(J, done);
+}
+
+
+/* LT/LE: integer and float cases; others go to the interpreter */
+static void t_order (JitState *J, int a, int ob, int oc, int le) {
+  JumpList notint;
+  notint.n = 0;
+  guardtag(J, ob, LUA_TNUMINT, &notint);
+  guardtag(J, oc, LUA_TNUMINT, &notint);
+  ld(J, rAX, opbase(ob), opdisp(ob));
+  alu(J, X_CMP, rAX, opbase(oc), opdisp(oc));
+  condjump(J, le ? CC_LE : CC_L, a);
+  patchlist(J, &notint);
+  guardtag(J, ob, LUA_TNUMFLT, &J->slow);
+  guardtag(J, oc, LUA_TNUMFLT, &J->slow);
+  ldsd(J, 0, opbase(oc), opdisp(oc));
+  ucomisd(J, 0, opbase(ob), opdisp(ob));  /* 'c > b' is 'b < c' */
+  condjump(J, le ? CC_AE : CC_A, a);
+}
+
+
+/* LTI/LEI/GTI/GEI: 'R(b) op sc' */
+static void t_orderi (JitState *J, OpCode o, int a, int b, int sc) {
+  JumpList notint;
+  notint.n = 0;
+  guardtag(J, b, LUA_TNUMINT, &notint);
+  cmpimm(J, 1, rBASE, b * TVSIZE, sc);
+  switch (o) {
+    case OP_LTI: condjump(J, CC_L, a); break;
+    case OP_LEI: condjump(J, CC_LE, a); break;
+    case OP_GTI: condjump(J, CC_G, a); break;
+    default: condjump(J, CC_GE, a); break;
+  }
+  patchlist(J, &notint);
+  guardtag(J, b, LUA_TNUMFLT, &J->slow);
+  movimm(J, rAX, cast(size_t, cast(lua_Integer, sc)));
+  cvtsi2sd(J, 1, rAX);
+  if (o == OP_LTI || o == OP_LEI) {
+    ucomisd(J, 1, rBASE, b * TVSIZE);  /* 'sc > b' is 'b < sc' */
+    condjump(J, (o == OP_LTI) ? CC_A : CC_AE, a);
+  }
+  else {
+    ldsd(J, 0, rBASE, b * TVSIZE);
+    ucomisdr(J, 0, 1);
+    condjump(J, (o == OP_GTI) ? CC_A : CC_AE, a);
+  }
+}
+
+
+/*
+** EQ: values with equal tags are compared inline when equality is
+** raw identity; numbers with different tags, floats, and objects
+** that may have '__eq' go to the interpreter.
+*/
+static void t_eq (JitState *J, int a, int ob, int oc) {
+  JumpList num, same64;
+  size_t diff, notbool;
+  num.n = same64.n = 0;
+  ld32(J, rAX, opbase(ob), opdisp(ob) + TTOFF);
+  emitm(J, 0, 0, X_CMP, rAX, opbase(oc), opdisp(oc) + TTOFF);
+  diff = jump(J, CC_NE, 0);
+  aluimm(J, 7, rAX, LUA_TNUMINT);  /* cmp rax, imm */
+  tolist(&same64, jump(J, CC_E, 0));
+  aluimm(J, 7, rAX, ctb(LUA_TSHRSTR));
+  tolist(&same64, jump(J, CC_E, 0));
+  aluimm(J, 7, rAX, LUA_TNIL);
+  jumppc(J, CC_E, condtarget(J, 1, a));
+  aluimm(J, 7, rAX, LUA_TBOOLEAN);
+  notbool = jump(J, CC_NE, 0);
+  ld32(J, rCX, opbase(ob), opdisp(ob));
+  emitm(J, 0, 0, X_CMP, rCX, opbase(oc), opdisp(oc));
+  condjump(J, CC_E, a);
+  patch(J, notbool);
+  slowif(J, CC_JMP);
+  patchlist(J, &same64);
+  ld(J, rCX, opbase(ob), opdisp(ob));
+  alu(J, X_CMP, rCX, opbase(oc), opdisp(oc));
+  condjump(J, CC_E, a);
+  patch(J, diff);  /* different tags: equal only if numbers */
+  aluimm(J, 7, rAX, LUA_TNUMINT);
+  tolist(&num, jump(J, CC_E, 0));
+  aluimm(J, 7, rAX, LUA_TNUMFLT);
+  jumppc(J, CC_NE, condtarget(J, 0, a));
+  patchlist(J, &num);
+  cmpimm(J, 0, opbase(oc), opdisp(oc) + TTOFF, LUA_TNUMINT);
+  slowif(J, CC_E);
+  cmpimm(J, 0, opbase(oc), opdisp(oc) + TTOFF, LUA_TNUMFLT);
+  slowif(J, CC_E);
+  jumppc(J, CC_JMP, condtarget(J, 0, a));
+}
+
+
+/* EQK: raw equality against a constant, specialized on its type */
+static void t_eqk (JitState *J, int a, int b, int kidx) {
+  const TValue *kv = &J->p->k[kidx];
+  int tt = b * TVSIZE + TTOFF;
+  switch (ttype(kv)) {
+    case LUA_TNIL: {
+      cmpimm(J, 0, rBASE, tt, LUA_TNIL);
+      condjump(J, CC_E, a);
+      break;
+    }
+    case LUA_TBOOLEAN: {
+      cmpimm(J, 0, rBASE, tt, LUA_TBOOLEAN);
+      jumppc(J, CC_NE, condtarget(J, 0, a));
+      cmpimm(J, 0, rBASE, b * TVSIZE, bvalue(kv));
+      condjump(J, CC_E, a);
+      break;
+    }
+    case LUA_TNUMINT: {
+      cmpimm(J, 0, rBASE, tt, LUA_TNUMFLT);
+      slowif(J, CC_E);  /* int x float: interpreter compares */
+      cmpimm(J, 0, rBASE, tt, LUA_TNUMINT);
+      jumppc(J, CC_NE, condtarget(J, 0, a));
+      movimm(J, rAX, cast(size_t, ivalue(kv)));
+      alu(J, X_CMP, rAX, rBASE, b * TVSIZE);
+      condjump(J, CC_E, a);
+      break;
+    }
+    case LUA_TSHRSTR: {  /* short strings are internalized */
+      cmpimm(J, 0, rBASE, tt, ctb(LUA_TSHRSTR));
+      jumppc(J, CC_NE, condtarget(J, 0, a));
+      movimm(J, rAX, cast(size_t, tsvalue(kv)));
+      alu(J, X_CMP, rAX, rBASE, b * TVSIZE);
+      condjump(J, CC_E, a);
+      break;
+    }
+    default: slowif(J, CC_JMP); break;
+  }
+}
+
+
+/* R(a) := T[okey], with table 'T' at '[tb + td]' */
+static void t_gettable (JitState *J, int a, int tb, int td, int okey) {
+  JumpList slow;
+  size_t done = 0;
+  slow.n = 0;
+  if (tableslot(J, tb, td, okey, &slow)) {
+    ldv(J, rAX, 0);
+    stv(J, rBASE, a * TVSIZE);
+    done = jump(J, CC_JMP, 0);
+  }
+  patchlist(J, &slow);
+  savepc(J, J->pc + 1);
+  lea(J, rSI, tb, td);
+  lea(J, rDX, opbase(okey), opdisp(okey));
+  lea(J, rCX, rBASE, a * TVSIZE);
+  callvm(J, fptr(j_gettable), 0);
+  if (done) patch(J, done);
+}
+
+
+/* R(a + 1) := R(b); R(a) := R(b)[okey] */
+static void t_self (JitState *J, int a, int b, int okey) {
+  JumpList slow;
+  size_t done = 0;
+  slow.n = 0;
+  if (tableslot(J, rBASE, b * TVSIZE, okey, &slow)) {
+    copyreg(J, a + 1, b);
+    ldv(J, rAX, 0);
+    stv(J, rBASE, a * TVSIZE);
+    done = jump(J, CC_JMP, 0);
+  }
+  patchlist(J, &slow);
+  savepc(J, J->pc + 1);
+  lea(J, rSI, rBASE, a * TVSIZE);
+  lea(J, rDX, rBASE, b * TVSIZE);
+  lea(J, rCX, opbase(okey), opdisp(okey));
+  callvm(J, fptr(j_self), 0);
+  if (done) patch(J, done);
+}
+
+
+/*
+** T[okey] := ov, with table 'T' at '[tb + td]': existing entries get
+** non-collectable values inline (no barrier needed); everything else
+** goes to the VM.
+*/
+static void t_settable (JitState *J, int tb, int td, int okey, int ov) {
+  JumpList slow;
+  size_t done = 0;
+  int vt = ktag(J, ov);
+  slow.n = 0;
+  if ((vt < 0 || !(vt & BIT_ISCOLLECTABLE)) &&
+      tableslot(J, tb, td, okey, &slow)) {
+    if (vt < 0) {
+      testimm(J, opbase(ov), opdisp(ov) + TTOFF, BIT_ISCOLLECTABLE);
+      tolist(&slow, jump(J, CC_NE, 0));
+    }
+    ldv(J, opbase(ov), opdisp(ov));
+    stv(J, rAX, 0);
+    done = jump(J, CC_JMP, 0);
+  }
+  patchlist(J, &slow);
+  savepc(J, J->pc + 1);
+  lea(J, rSI, tb, td);
+  lea(J, rDX, opbase(okey), opdisp(okey));
+  lea(J, rCX, opbase(ov), opdisp(ov));
+  callvm(J, fptr(j_settable), 0);
+  if (done) patch(J, done);
+}
+
+
+/* load into 'reg' the value of upvalue 'n' ('TValue *') */
+static void upvalue (JitState *J, int reg, int n) {
+  ld(J, reg, rCL, fieldof(LClosure, upvals) + n * cast_int(sizeof(UpVal *)));
+  ld(J, reg, reg, fieldof(UpVal, v));
+}
+
+
+/* FORLOOP: integer loops inline; float loops go to the interpreter */
+static void t_forloop (JitState *J, int a, int target) {
+  size_t neg, cont, exit1, exit2;
+  guardtag(J, a, LUA_TNUMINT, &J->slow);
+  ld(J, rAX, rBASE, a * TVSIZE);
+  alu(J, X_ADD, rAX, rBASE, (a + 2) * TVSIZE);  /* idx += step */
+  ld(J, rDX, rBASE, (a + 1) * TVSIZE);  /* limit */
+  ld(J, rCX, rBASE, (a + 2) * TVSIZE);  /* step */
+  emitr(J, 0, 1, 0x85, rCX, rCX);  /* test rcx, rcx */
+  neg = jump(J, CC_LE, 0);
+  emitr(J, 0, 1, 0x39, rDX, rAX);  /* cmp rax, rdx */
+  exit1 = jump(J, CC_G, 0);  /* idx > limit: loop ends */
+  cont = jump(J, CC_JMP, 0);
+  patch(J, neg);
+  emitr(J, 0, 1, 0x39, rDX, rAX);  /* cmp rax, rdx */
+  exit2 = jump(J, CC_L, 0);  /* idx < limit: loop ends */
+  patch(J, cont);
+  st(J, rAX, rBASE, a * TVSIZE);  /* update internal index... */
+  st(J, rAX, rBASE, (a + 3) * TVSIZE);  /* ...and external index */
+  stimm(J, rBASE, (a + 3) * TVSIZE + TTOFF, LUA_TNUMINT);
+  backedge(J, target);
+  patch(J, exit1);
+  patch(J, exit2);
+}
+
+
+static void compileins (JitState *J, Instruction i) {
+  OpCode o = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  switch (o) {
+    case OP_MOVE: {
+      copyreg(J, a, GETARG_B(i));
+      break;
+    }
+    case OP_LOADK: {
+      ldv(J, rK, GETARG_Bx(i) * TVSIZE);
+      stv(J, rBASE, a * TVSIZE);
+      break;
+    }
+    case OP_LOADBOOL: {
+      stimm(J, rBASE, a * TVSIZE, GETARG_B(i));
+      stimm(J, rBASE, a * TVSIZE + TTOFF, LUA_TBOOLEAN);
+      if (GETARG_C(i))
+        jumppc(J, CC_JMP, J->pc + 2);  /* skip next instruction */
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        stimm(J, rBASE, (a++) * TVSIZE + TTOFF, LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      upvalue(J, rAX, GETARG_B(i));
+      ldv(J, rAX, 0);
+      stv(J, rBASE, a * TVSIZE);
+      break;
+    }
+    case OP_SETUPVAL: {
+      savepc(J, J->pc + 1);
+      ld(J, rSI, rCL, fieldof(LClosure, upvals) +
+                      GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      lea(J, rDX, rBASE, a * TVSIZE);
+      callvm(J, fptr(j_setupval), 0);
+      break;
+    }
+    case OP_GETTABUP: {
+      upvalue(J, rSI, GETARG_B(i));
+      t_gettable(J, a, rSI, 0, oprk(GETARG_C(i)));
+      break;
+    }
+    case OP_SETTABUP: {
+      upvalue(J, rSI, a);
+      t_settable(J, rSI, 0, oprk(GETARG_B(i)), oprk(GETARG_C(i)));
+      break;
+    }
+    case OP_GETTABLE: {
+      t_gettable(J, a, rBASE, GETARG_B(i) * TVSIZE, oprk(GETARG_C(i)));
+      break;
+    }
+    case OP_SETTABLE: {
+      t_settable(J, rBASE, a * TVSIZE, oprk(GETARG_B(i)), oprk(GETARG_C(i)));
+      break;
+    }
+    case OP_SELF: {
+      t_self(J, a, GETARG_B(i), oprk(GETARG_C(i)));
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_MOD: case OP_POW: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR: {
+      int op = cast_int(o - OP_ADD) + LUA_OPADD;
+      unsigned int iop = 0, fop = 0;
+      switch (o) {
+        case OP_ADD: iop = X_ADD; fop = X_ADDSD; break;
+        case OP_SUB: iop = X_SUB; fop = X_SUBSD; break;
+        case OP_MUL: iop = X_IMUL; fop = X_MULSD; break;
+        case OP_DIV: fop = X_DIVSD; break;
+        case OP_MOD: iop = X_MOD; break;
+        case OP_IDIV: iop = X_IDIV; break;
+        case OP_BAND: iop = X_AND; break;
+        case OP_BOR: iop = X_OR; break;
+        case OP_BXOR: iop = X_XOR; break;
+        default: break;  /* others always call 'luaO_arith' */
+      }
+      t_arith(J, a, oprk(GETARG_B(i)), oprk(GETARG_C(i)), op, iop, fop);
+      break;
+    }
+    case OP_UNM: case OP_BNOT: {
+      int op = (o == OP_UNM) ? LUA_OPUNM : LUA_OPBNOT;
+      t_arith(J, a, GETARG_B(i), GETARG_B(i), op, 0, 0);
+      break;
+    }
+    case OP_ADDI: {
+      t_addi(J, a, GETARG_B(i), GETARG_sC(i));
+      break;
+    }
+    case OP_ADDK: {
+      t_arith(J, a, GETARG_B(i), opk(GETARG_C(i)), LUA_OPADD, X_ADD, X_ADDSD);
+      break;
+    }
+    case OP_NOT: {
+      JumpList yes;
+      size_t store;
+      yes.n = 0;
+      checkfalse(J, GETARG_B(i), &yes);
+      stimm(J, rBASE, a * TVSIZE, 0);
+      store = jump(J, CC_JMP, 0);
+      patchlist(J, &yes);
+      stimm(J, rBASE, a * TVSIZE, 1);
+      patch(J, store);
+      stimm(J, rBASE, a * TVSIZE + TTOFF, LUA_TBOOLEAN);
+      break;
+    }
+    case OP_LEN: {
+      savepc(J, J->pc + 1);
+      lea(J, rSI, rBASE, a * TVSIZE);
+      lea(J, rDX, rBASE, GETARG_B(i) * TVSIZE);
+      callvm(J, fptr(luaV_objlen), 0);
+      break;
+    }
+    case OP_JMP: {
+      int target = J->pc + 1 + GETARG_sBx(i);
+      if (a != 0)  /* must close upvalues? */
+        slowif(J, CC_JMP);
+      else if (target <= J->pc)
+        backedge(J, target);
+      else
+        jumppc(J, CC_JMP, target);
+      break;
+    }
+    case OP_EQ: {
+      t_eq(J, a, oprk(GETARG_B(i)), oprk(GETARG_C(i)));
+      break;
+    }
+    case OP_LT: case OP_LE: {
+      t_order(J, a, oprk(GETARG_B(i)), oprk(GETARG_C(i)), o == OP_LE);
+      break;
+    }
+    case OP_EQK: {
+      t_eqk(J, a, GETARG_B(i), GETARG_C(i));
+      break;
+    }
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      t_orderi(J, o, a, GETARG_B(i), GETARG_sC(i));
+      break;
+    }
+    case OP_TEST: {
+      JumpList isfalse;
+      int c = GETARG_C(i);
+      isfalse.n = 0;
+      checkfalse(J, a, &isfalse);
+      jumppc(J, CC_JMP, c ? J->pc + 1 : J->pc + 2);
+      patchlist(J, &isfalse);
+      jumppc(J, CC_JMP, c ? J->pc + 2 : J->pc + 1);
+      break;
+    }
+    case OP_TESTSET: {
+      JumpList isfalse;
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      isfalse.n = 0;
+      checkfalse(J, b, &isfalse);
+      if (c) copyreg(J, a, b);
+      jumppc(J, CC_JMP, c ? J->pc + 1 : J->pc + 2);
+      patchlist(J, &isfalse);
+      if (!c) copyreg(J, a, b);
+      jumppc(J, CC_JMP, c ? J->pc + 2 : J->pc + 1);
+      break;
+    }
+    case OP_CALL: {
+      savepc(J, J->pc + 1);
+      lea(J, rSI, rBASE, a * TVSIZE);
+      movimm32(J, rDX, GETARG_B(i));
+      movimm32(J, rCX, GETARG_C(i) - 1);
+      callvm(J, fptr(j_call), 1);
+      break;
+    }
+    case OP_FORLOOP: {
+      t_forloop(J, a, J->pc + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_FORPREP: {  /* integer loops inline */
+      guardtag(J, a, LUA_TNUMINT, &J->slow);
+      guardtag(J, a + 1, LUA_TNUMINT, &J->slow);
+      guardtag(J, a + 2, LUA_TNUMINT, &J->slow);
+      ld(J, rAX, rBASE, a * TVSIZE);
+      alu(J, X_SUB, rAX, rBASE, (a + 2) * TVSIZE);
+      st(J, rAX, rBASE, a * TVSIZE);
+      jumppc(J, CC_JMP, J->pc + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_TFORCALL: {
+      savepc(J, J->pc + 1);
+      lea(J, rSI, rBASE, a * TVSIZE);
+      movimm32(J, rDX, GETARG_C(i));
+      callvm(J, fptr(j_tforcall), 0);
+      break;  /* fall into the following TFORLOOP */
+    }
+    case OP_TFORLOOP: {
+      size_t done;
+      cmpimm(J, 0, rBASE, (a + 1) * TVSIZE + TTOFF, LUA_TNIL);
+      done = jump(J, CC_E, 0);
+      copyreg(J, a, a + 1);
+      backedge(J, J->pc + 1 + GETARG_sBx(i));
+      patch(J, done);
+      break;
+    }
+    default: {  /* other instructions run in the interpreter */
+      slowif(J, CC_JMP);
+      break;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Entry points and type analysis
+** =======================================================
+*/
+
+/* analysis is skipped for functions whose state would be larger */
+#define MAXTYSTATE	(1 << 20)
+
+/* ...or when it does not converge after this many passes */
+#define MAXTYPASSES	16
+
+
+/* type state before instruction 'pc': 'reached' flag plus a tag for
+   each register */
+#define tyrow(J,pc)  \
+  ((J)->types + cast(size_t, pc) * ((J)->p->maxstacksize + 1))
+
+
+static void findentries (JitState *J) {
+  Proto *p = J->p;
+  int pc;
+  memset(J->ekind, EK_NONE, p->sizecode);
+  J->ekind[0] = EK_ANY;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction i = luaP_generic(p->code[pc]);
+    switch (GET_OPCODE(i)) {
+      case OP_CALL: {  /* return point */
+        if (pc + 1 < p->sizecode)
+          J->ekind[pc + 1] = EK_ANY;
+        break;
+      }
+      case OP_JMP: case OP_TFORLOOP: {
+        int target = pc + 1 + GETARG_sBx(i);
+        if (target <= pc)
+          J->ekind[target] = EK_ANY;
+        break;
+      }
+      case OP_FORLOOP: {  /* typed entry if 'luaJ_run' can find 'a' */
+        int target = pc + 1 + GETARG_sBx(i);
+        Instruction prep = p->code[target - 1];
+        if (J->ekind[target] == EK_NONE && GET_OPCODE(prep) == OP_FORPREP &&
+            GETARG_A(prep) == GETARG_A(i))
+          J->ekind[target] = EK_LOOP;
+        else
+          J->ekind[target] = EK_ANY;
+        break;
+      }
+      default: break;
+    }
+  }
+}
+
+
+/* type of operand 'o' in state 'st' (TY_UNK if unknown) */
+static int tyof (JitState *J, const lu_byte *st, int o) {
+  return isopk(o) ? ktag(J, o) : st[o];
+}
+
+
+/* result type of arithmetic 'o' on numbers, or -1 for other operands */
+static int arithtype (OpCode o, int tb, int tc) {
+  if ((tb != LUA_TNUMINT && tb != LUA_TNUMFLT) ||
+      (tc != LUA_TNUMINT && tc != LUA_TNUMFLT))
+    return -1;  /* may call a metamethod */
+  switch (o) {
+    case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_BNOT: return LUA_TNUMINT;
+    case OP_DIV: case OP_POW: return LUA_TNUMFLT;
+    default:
+      return (tb == LUA_TNUMINT && tc == LUA_TNUMINT) ? LUA_TNUMINT
+                                                       : LUA_TNUMFLT;
+  }
+}
+
+
+/* merge state 'st' into the state before 'pc'; return true if it changed */
+static int flowto (JitState *J, int pc, const lu_byte *st) {
+  lu_byte *row = tyrow(J, pc);
+  int n = J->p->maxstacksize;
+  int changed = 0;
+  int r;
+  if (!row[0]) {  /* first path reaching 'pc'? */
+    row[0] = 1;
+    memcpy(row + 1, st, n);
+    return 1;
+  }
+  for (r = 0; r < n; r++) {
+    if (row[r + 1] != st[r] && row[r + 1] != TY_UNK) {
+      row[r + 1] = TY_UNK;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Propagate the state before 'pc' to the successors of that
+** instruction in native code ('st' is scratch space). Anything that may
+** run Lua code (metamethods, calls) forgets all types, as that code may
+** change registers through the debug library; slow paths leave native
+** code, which is reentered only at entry points.
+*/
+static int propagate (JitState *J, int pc, lu_byte *st) {
+  Proto *p = J->p;
+  Instruction i = luaP_generic(p->code[pc]);
+  OpCode o = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  int changed = 0;
+  memcpy(st, tyrow(J, pc) + 1, p->maxstacksize);
+  switch (o) {
+    case OP_MOVE: st[a] = st[GETARG_B(i)]; break;
+    case OP_LOADK: st[a] = cast_byte(ktag(J, opk(GETARG_Bx(i)))); break;
+    case OP_LOADBOOL: {
+      st[a] = LUA_TBOOLEAN;
+      if (GETARG_C(i))
+        return flowto(J, pc + 2, st);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        st[a++] = LUA_TNIL;
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: st[a] = TY_UNK; break;
+    case OP_SETUPVAL: break;
+    case OP_GETTABUP: case OP_SETTABUP: case OP_GETTABLE: case OP_SETTABLE:
+    case OP_SELF: case OP_LEN: case OP_CALL: case OP_TFORCALL: {
+      memset(st, TY_UNK, p->maxstacksize);
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_MOD: case OP_POW: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+    case OP_UNM: case OP_BNOT: case OP_ADDI: case OP_ADDK: {
+      int t;
+      if (o == OP_ADDI)
+        t = arithtype(OP_ADD, st[GETARG_B(i)], LUA_TNUMINT);
+      else if (o == OP_ADDK)
+        t = arithtype(OP_ADD, st[GETARG_B(i)], ktag(J, opk(GETARG_C(i))));
+      else if (o == OP_UNM || o == OP_BNOT)
+        t = arithtype(o, st[GETARG_B(i)], st[GETARG_B(i)]);
+      else
+        t = arithtype(o, tyof(J, st, oprk(GETARG_B(i))),
+                         tyof(J, st, oprk(GETARG_C(i))));
+      if (t < 0) {
+        memset(st, TY_UNK, p->maxstacksize);
+        t = TY_UNK;
+      }
+      st[a] = cast_byte(t);
+      break;
+    }
+    case OP_NOT: st[a] = LUA_TBOOLEAN; break;
+    case OP_JMP: {
+      if (a != 0)
+        return 0;  /* leaves native code */
+      return flowto(J, pc + 1 + GETARG_sBx(i), st);
+    }
+    case OP_EQ: case OP_LT: case OP_LE: case OP_EQK:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: case OP_TEST: {
+      changed = flowto(J, pc + 2, st);
+      break;
+    }
+    case OP_TESTSET: {
+      changed = flowto(J, pc + 2, st);
+      st[a] = st[GETARG_B(i)];
+      break;
+    }
+    case OP_FORPREP: {  /* native code handles only integer loops */
+      st[a] = st[a + 1] = st[a + 2] = LUA_TNUMINT;
+      return flowto(J, pc + 1 + GETARG_sBx(i), st);
+    }
+    case OP_FORLOOP: {
+      st[a] = st[a + 1] = st[a + 2] = LUA_TNUMINT;
+      changed = flowto(J, pc + 1, st);
+      st[a + 3] = LUA_TNUMINT;
+      return changed | flowto(J, pc + 1 + GETARG_sBx(i), st);
+    }
+    case OP_TFORLOOP: {
+      changed = flowto(J, pc + 1, st);
+      st[a] = st[a + 1];
+      return changed | flowto(J, pc + 1 + GETARG_sBx(i), st);
+    }
+    default: return 0;  /* leaves native code */
+  }
+  return changed | flowto(J, pc + 1, st);
+}
+
+
+/*
+** Compute the type state before each instruction, iterating to a fixed
+** point. Entry points start with all types unknown, except the control
+** variables of integer loops. Gives up ('types' = NULL) on functions
+** that take too long to converge.
+*/
+static void analyze (JitState *J) {
+  Proto *p = J->p;
+  int n = p->maxstacksize;
+  lu_byte *st = tyrow(J, p->sizecode);  /* scratch state */
+  int pc, passes, changed;
+  memset(J->types, 0, cast(size_t, p->sizecode) * (n + 1));
+  for (pc = 0; pc < p->sizecode; pc++) {
+    lu_byte *row = tyrow(J, pc);
+    if (J->ekind[pc] != EK_NONE) {
+      row[0] = 1;
+      memset(row + 1, TY_UNK, n);
+    }
+    if (J->ekind[pc] == EK_LOOP) {  /* (see 'findentries') */
+      int a = GETARG_A(p->code[pc - 1]);
+      row[a + 1] = row[a + 2] = row[a + 3] = row[a + 4] = LUA_TNUMINT;
+    }
+  }
+  passes = 0;
+  do {
+    if (++passes > MAXTYPASSES) {
+      J->types = NULL;
+      return;
+    }
+    changed = 0;
+    for (pc = 0; pc < p->sizecode; pc++) {
+      if (tyrow(J, pc)[0])
+        changed |= propagate(J, pc, st);
+    }
+  } while (changed);
+}
+
+/* }====================================================== */
+
+
+static void epilogue (JitState *J) {
+  aluimm(J, 0, rSP, 8);
+  pop(J, r15); pop(J, r14); pop(J, r13); pop(J, r12);
+  pop(J, rBX); pop(J, rBP);
+  eb(J, 0xC3);  /* ret */
+}
+
+
+/*
+** Generate code for the whole function. Called three times: to compute
+** the code size, to compute instruction offsets (written directly in
+** the final block), and to emit the code.
+*/
+static void compile (JitState *J) {
+  Proto *p = J->p;
+  int pc;
+  J->pos = 0;
+  /* entry sequence */
+  push(J, rBP); push(J, rBX); push(J, r12); push(J, r13);
+  push(J, r14); push(J, r15);
+  aluimm(J, 5, rSP, 8);  /* keep stack aligned */
+  mov(J, rL, rDI);
+  mov(J, rCI, rSI);
+  ld(J, rBASE, rCI, fieldof(CallInfo, u.l.base));
+  ld(J, rCL, rCI, fieldof(CallInfo, func));
+  ld(J, rCL, rCL, 0);  /* clLvalue(ci->func) */
+  movimm(J, rK, cast(size_t, p->k));
+  emitr(J, 0, 0, 0xFF, 4, rDX);  /* jmp rdx */
+  /* exit sequences */
+  J->exit0 = J->pos;
+  eb(J, 0x31); eb(J, 0xC0);  /* xor eax, eax */
+  epilogue(J);
+  J->exit1 = J->pos;
+  movimm32(J, rAX, 1);
+  epilogue(J);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    if (J->mcode == NULL && J->pcoff != NULL) {
+      J->pcoff[pc] = cast(unsigned int, J->pos);
+      if (J->ekind[pc] == EK_NONE)
+        J->entry[pc] = 0;
+      else  /* offset plus loop flag (see 'luaJ_run') */
+        J->entry[pc] = (cast(unsigned int, J->pos) << 1) |
+                       (J->ekind[pc] == EK_LOOP);
+    }
+    lua_assert(J->mcode == NULL || J->pcoff[pc] == J->pos);
+    J->pc = pc;
+    J->ty = (J->types != NULL && tyrow(J, pc)[0]) ? tyrow(J, pc) + 1 : NULL;
+    J->slow.n = 0;
+    compileins(J, luaP_generic(p->code[pc]));
+    if (J->slow.n > 0) {  /* add exit for the slow cases */
+      if (pc + 1 < p->sizecode)
+        jumppc(J, CC_JMP, pc + 1);
+      patchlist(J, &J->slow);
+      exitat(J, pc);
+    }
+  }
+}
+
+
+int luaJ_compile (lua_State *L, Proto *p) {
+  global_State *g = G(L);
+  JitState J;
+  JitCode *jc;
+  size_t tsize, hsize, size;
+  void *mem;
+  p->jitcount = 0;  /* do not try again */
+  J.p = p;
+  J.mcode = NULL;
+  J.pcoff = J.entry = NULL;
+  tsize = cast(size_t, p->sizecode + 1) * (p->maxstacksize + 1);
+  if (tsize > MAXTYSTATE)
+    tsize = 0;  /* no type analysis */
+  J.ekind = cast(lu_byte *, (*g->frealloc)(g->ud, NULL, 0,
+                                          p->sizecode + tsize));
+  if (J.ekind == NULL)
+    return 0;
+  findentries(&J);
+  J.types = (tsize > 0) ? J.ekind + p->sizecode : NULL;
+  if (J.types != NULL)
+    analyze(&J);
+  compile(&J);  /* compute code size */
+  hsize = offsetof(JitCode, pcoff) + 2 * p->sizecode * sizeof(unsigned int);
+  hsize = (hsize + 15) & ~cast(size_t, 15);
+  size = hsize + J.pos;
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    mem = NULL;
+  else {
+    jc = cast(JitCode *, mem);
+    jc->size = size;
+    jc->mcode = cast(lu_byte *, mem) + hsize;
+    jc->entry = jc->pcoff + p->sizecode;
+    J.pcoff = jc->pcoff;
+    J.entry = jc->entry;
+    compile(&J);  /* compute instruction offsets */
+    J.mcode = jc->mcode;
+    compile(&J);  /* emit code */
+    lua_assert(hsize + J.pos == size);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(mem, size);
+      mem = NULL;
+    }
+  }
+  (*g->frealloc)(g->ud, J.ekind, p->sizecode + tsize, 0);
+  if (mem == NULL)
+    return 0;
+  p->jit = jc;
+  return 1;
+}
+
+
+/*
+** Run native code for the Lua frame 'ci' from its 'savedpc'. Returns 0
+** when the interpreter must go on with this frame (from its 'savedpc')
+** and 1 when native code started a call to a Lua function, whose frame
+** is now 'L->ci'. Entries hold the instruction offset shifted left; the
+** low bit marks loop heads, entered only when the control variable (in
+** the register of the preceding FORPREP) is an integer.
+*/
+int luaJ_run (lua_State *L, CallInfo *ci) {
+  Proto *p = clLvalue(ci->func)->p;
+  JitCode *jc = p->jit;
+  JitEntry f = cast(JitEntry, cast(void *, jc->mcode));
+  int pc = cast_int(ci->u.l.savedpc - p->code);
+  unsigned int e = jc->entry[pc];
+  lua_assert(isLua(ci) && jc != NULL);
+  if (e == 0)
+    return 0;  /* not an entry point */
+  if ((e & 1) && !ttisinteger(ci->u.l.base + GETARG_A(p->code[pc - 1])))
+    return 0;  /* float loop */
+  return (*f)(L, ci, jc->mcode + (e >> 1));
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  UNUSED(L);
+  if (p->jit != NULL)
+    munmap(p->jit, p->jit->size);
+}
+
+#endif				/* } */
+
@@ -0,0 +1,58 @@
+/*
+** $Id: ljit.h $
+** Baseline compiler from Lua bytecode to native code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** The compiler needs an x86-64 POSIX system (code lives in mmap'ed
+** memory) and errors implemented with longjmp (C++ exceptions cannot
+** unwind through native frames). Opcode statistics count only what
+** the interpreter runs.
+*/
+#if defined(LUA_USE_JIT) && defined(__x86_64__) && \
+    defined(LUA_USE_POSIX) && \
+    (!defined(__cplusplus) || defined(LUA_USE_LONGJMP)) && \
+    !defined(LUAI_OPSTATS)
+#define LUAJ_ENABLED
+#endif
+
+
+/* number of calls plus loop iterations before a function is compiled */
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	64
+#endif
+
+
+#if defined(LUAJ_ENABLED)
+
+/*
+** True if the current frame of function 'p' can run native code now,
+** compiling 'p' if it became hot. Line and count hooks (and profiler
+** samples) need the interpreter.
+*/
+#define luaJ_ready(L,p)  \
+  (!((L)->hookmask & TRACEMASK) && \
+   ((p)->jit != NULL || \
+    ((p)->jitcount > 0 && --(p)->jitcount == 0 && luaJ_compile(L, p))))
+
+LUAI_FUNC int luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC int luaJ_run (lua_State *L, CallInfo *ci);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#else
+
+#define luaJ_ready(L,p)		0
+#define luaJ_run(L,ci)		0
+#define luaJ_free(L,p)		((void)0)
+
+#endif
+
+#endif
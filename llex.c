@@ -71,6 +71,109 @@ static void save (LexState *ls, int c) {
 }
 
 
+/*
+** Fast paths: most tokens lie entirely inside the block of input
+** already read by the ZIO, so runs of chars can be scanned there in
+** place and saved with one copy instead of going through 'next' and
+** 'save' one char at a time. When 'ls->current' is not EOZ, it is
+** the char just before 'ls->z->p'.
+*/
+
+/*
+** skips 'current' and the next 'k' chars of the input block and
+** reads the char after them
+*/
+static void skipchars (LexState *ls, size_t k) {
+  ZIO *z = ls->z;
+  lua_assert(ls->current != EOZ && k <= z->n);
+  z->p += k;
+  z->n -= k;
+  next(ls);
+}
+
+
+/*
+** saves 'current' and the next 'k' chars of the input block and
+** reads the char after them
+*/
+static void savechars (LexState *ls, size_t k) {
+  Mbuffer *b = ls->buff;
+  size_t l = k + 1;
+  lua_assert(cast_uchar(ls->z->p[-1]) == ls->current);
+  if (luaZ_sizebuffer(b) - luaZ_bufflen(b) < l) {
+    size_t newsize = luaZ_sizebuffer(b);
+    do {
+      if (newsize >= MAX_SIZE/2)
+        lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    } while (newsize - luaZ_bufflen(b) < l);
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + luaZ_bufflen(b), ls->z->p - 1, l);
+  luaZ_bufflen(b) += l;
+  skipchars(ls, k);
+}
+
+
+/* length of the run of identifier chars at the input block */
+static size_t namerun (ZIO *z) {
+  const char *p = z->p;
+  size_t n = z->n;
+  size_t k = 0;
+  while (k < n && lislalnum(cast_uchar(p[k]))) k++;
+  return k;
+}
+
+
+/* length of the run of non-newline spaces at the input block */
+static size_t spacerun (ZIO *z) {
+  const char *p = z->p;
+  size_t n = z->n;
+  size_t k = 0;
+  while (k < n && (p[k] == ' ' || p[k] == '\t' ||
+                   p[k] == '\f' || p[k] == '\v')) k++;
+  return k;
+}
+
+
+/* length of the run of chars at the input block up to a newline */
+static size_t linerun (ZIO *z) {
+  const char *p = z->p;
+  size_t n = z->n;
+  size_t k = 0;
+  while (k < n && p[k] != '\n' && p[k] != '\r') k++;
+  return k;
+}
+
+
+/*
+** length of the run of digits and dots at the input block, stopping
+** at exponent marks 'expo' (which may be followed by a sign)
+*/
+static size_t digitrun (ZIO *z, const char *expo) {
+  const char *p = z->p;
+  size_t n = z->n;
+  size_t k = 0;
+  while (k < n && (lisxdigit(cast_uchar(p[k])) || p[k] == '.') &&
+                  p[k] != expo[0] && p[k] != expo[1]) k++;
+  return k;
+}
+
+
+/*
+** length of the run of chars at the input block that need no special
+** handling inside a string closed by 'del'
+*/
+static size_t strrun (ZIO *z, int del) {
+  const char *p = z->p;
+  size_t n = z->n;
+  size_t k = 0;
+  while (k < n && p[k] != del && p[k] != '\\' &&
+                  p[k] != '\n' && p[k] != '\r') k++;
+  return k;
+}
+
+
 /*
 ** Lua的Token分割器会将语法的保留字分割出来
 ** 保留字是一个luaX_tokens类型的数组,对应了RESERVED里面的Token类型
@@ -131,15 +234,21 @@ l_noret luaX_syntaxerror (LexState *ls, const char *msg) {
 
 
 /*
-** creates a new string and anchors it in scanner's table so that
-** it will not be collected until the end of the compilation
-** (by that time it should be anchored somewhere)
+** anchors a new string in scanner's table so that it will not be
+** collected until the end of the compilation (by that time it should
+** be anchored somewhere). A data chunk stores each string before
+** reading the next token, so it needs to anchor only the last one.
 */
-TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
+static TString *anchorstr (LexState *ls, TString *ts) {
   lua_State *L = ls->L;
-  TValue *o;  /* entry for 'str' */
-  TString *ts = luaS_newlstr(L, str, l);  /* create new string */
+  TValue *o;  /* entry for 'ts' */
   setsvalue2s(L, L->top++, ts);  /* temporarily anchor it in stack */
+  if (ls->isdata) {
+    luaH_setint(L, ls->h, 1, L->top - 1);  /* t[1] = string */
+    luaC_barrierback(L, ls->h, L->top - 1);
+    L->top--;  /* remove string from stack */
+    return ts;
+  }
   o = luaH_set(L, ls->h, L->top - 1);
   if (ttisnil(o)) {  /* not in use yet? */
     /* boolean value does not need GC barrier;
@@ -155,6 +264,11 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
 }
 
 
+TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
+  return anchorstr(ls, luaS_newlstr(ls->L, str, l));  /* create new string */
+}
+
+
 /*
 ** increment line number and skips newline sequence (any of
 ** \n, \r, \n\r, or \r\n)
@@ -178,6 +292,7 @@ void luaX_setinput (lua_State *L, LexState *ls, ZIO *z, TString *source,
   ls->lookahead.token = TK_EOS;  /* no look-ahead token */
   ls->z = z;
   ls->fs = NULL;
+  ls->isdata = 0;
   ls->linenumber = 1;
   ls->lastline = 1;
   ls->source = source;
@@ -234,10 +349,8 @@ static int read_numeral (LexState *ls, SemInfo *seminfo) {
   for (;;) {
     if (check_next2(ls, expo))  /* exponent part? */
       check_next2(ls, "-+");  /* optional exponent sign */
-    if (lisxdigit(ls->current))
-      save_and_next(ls);
-    else if (ls->current == '.')
-      save_and_next(ls);
+    if (lisxdigit(ls->current) || ls->current == '.')
+      savechars(ls, digitrun(ls->z, expo));
     else break;
   }
   save(ls, '\0');
@@ -301,8 +414,8 @@ static void read_long_string (LexState *ls, SemInfo *seminfo, int sep) {
         break;
       }
       default: {
-        if (seminfo) save_and_next(ls);
-        else next(ls);
+        if (seminfo) savechars(ls, strrun(ls->z, ']'));
+        else skipchars(ls, strrun(ls->z, ']'));
       }
     }
   } endloop:
@@ -376,7 +489,7 @@ static int readdecesc (LexState *ls) {
 
 
 static void read_string (LexState *ls, int del, SemInfo *seminfo) {
-  save_and_next(ls);  /* keep delimiter (for error messages) */
+  savechars(ls, strrun(ls->z, del));  /* keep delimiter (for error messages) */
   while (ls->current != del) {
     switch (ls->current) {
       case EOZ:
@@ -429,7 +542,7 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
        no_save: break;
       }
       default:
-        save_and_next(ls);
+        savechars(ls, strrun(ls->z, del));
     }
   }
   save_and_next(ls);  /* skip delimiter */
@@ -458,7 +571,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  /* spaces */
-        next(ls);
+        skipchars(ls, spacerun(ls->z));
         break;
       }
       case '-': {  /* '-' or '--' (comment) */
@@ -477,7 +590,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         }
         /* else short comment */
         while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+          skipchars(ls, linerun(ls->z));  /* skip until end of line (or EOF) */
         break;
       }
       case '[': {  /* long string or simply '[' - 长字符串处理 */
@@ -547,10 +660,12 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
           do {
-            save_and_next(ls);
+            savechars(ls, namerun(ls->z));
           } while (lislalnum(ls->current));
-          ts = luaX_newstring(ls, luaZ_buffer(ls->buff),
-                                  luaZ_bufflen(ls->buff));
+          ts = luaS_newlstr(ls->L, luaZ_buffer(ls->buff),
+                                   luaZ_bufflen(ls->buff));
+          if (!isreserved(ts))  /* reserved words are never collected */
+            ts = anchorstr(ls, ts);
           seminfo->ts = ts;
           if (isreserved(ts))  /* reserved word? - 保留关键字? */
             return ts->extra - 1 + FIRST_RESERVED;
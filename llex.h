@@ -86,6 +86,7 @@ typedef struct LexState {
   ZIO *z;  /* input stream - io输入流 */
   Mbuffer *buff;  /* buffer for tokens */
   Table *h;  /* to avoid collection/reuse strings */
+  lu_byte isdata;  /* data chunk? ('h' anchors only the last string) */
   struct Dyndata *dyd;  /* dynamic structures used by the parser */
   TString *source;  /* current source name - 当前源名称 */
   TString *envn;  /* environment variable name - 环境变量 */
@@ -33,6 +33,7 @@ typedef long l_mem;
 
 /* chars used as small naturals (so that 'char' is reserved for characters) */
 typedef unsigned char lu_byte;
+typedef signed char ls_byte;
 
 
 /* maximum value for size_t */
@@ -154,6 +155,16 @@ typedef LUAI_UACINT l_uacInt;
 #endif
 
 
+/*
+** default optimization level of the code generator (see 'luaK_optimize');
+** 0 turns the optimizer off
+*/
+#if !defined(LUAI_OPTLEVEL)
+#define LUAI_OPTLEVEL		0
+#endif
+
+#define MAXOPTLEVEL	2
+
 
 /*
 ** type for virtual-machine instructions;
@@ -91,6 +91,13 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
 #endif
+  if (nsize > realosize &&
+      gettotalbytes(g) + (nsize - realosize) > g->GChardlimit) {
+    if (g->version)  /* is state fully built? */
+      luaC_fullgc(L, 1);  /* try to free some memory... */
+    if (gettotalbytes(g) + (nsize - realosize) > g->GChardlimit)
+      luaD_throw(L, LUA_ERRMEM);  /* over the limit */
+  }
   newblock = (*g->frealloc)(g->ud, block, osize, nsize);
   if (newblock == NULL && nsize > 0) {
     lua_assert(nsize > realosize);  /* cannot fail when shrinking a block */
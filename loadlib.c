@@ -493,12 +493,363 @@ static int checkload (lua_State *L, int stat, const char *filename) {
 }
 
 
+/*
+** {======================================================
+** Compile cache for Lua modules
+** =======================================================
+*/
+
+/*
+** LUA_CACHEDIR_VAR is the name of the environment variable with the
+** directory for the compile cache ('package.cachedir'). Without it
+** (and unless a program sets that field) there is no cache.
+*/
+#if !defined(LUA_CACHEDIR_VAR)
+#define LUA_CACHEDIR_VAR	"LUA_CACHEDIR"
+#endif
+
+/* default value for 'package.cachesize' (in bytes) */
+#if !defined(LUA_CACHESIZE)
+#define LUA_CACHESIZE		(64 * 1024 * 1024)
+#endif
+
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHEMAGIC	"\x1bLuaMC1"
+#define CACHESUFFIX	".luac"
+
+/* maximum length of the name of a cache entry (plus 1) */
+#define MAXCACHENAME	(2 * sizeof(size_t) + sizeof(CACHESUFFIX))
+
+
+/*
+** A cache entry is a file with this key, the path of the source, and
+** the compiled chunk
+*/
+typedef struct CacheKey {
+  char magic[sizeof(CACHEMAGIC)];
+  size_t hash;  /* hash of the contents of the source */
+  long mtime;  /* modification time of the source */
+  long size;  /* size of the source */
+  int optlevel;  /* optimization level of the compiled code */
+  size_t pathlen;  /* length of the path of the source */
+} CacheKey;
+
+
+typedef struct CacheEntry {
+  long mtime;
+  long size;
+  char name[MAXCACHENAME];
+} CacheEntry;
+
+
+/* FNV-1a hash of 'n' bytes at 's', continuing from hash 'h' */
+static size_t hashbytes (size_t h, const char *s, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h;
+}
+
+
+/*
+** Read source file 'filename' into a new userdata on the stack and fill
+** its key; returns 0 (pushing nothing) if it cannot read it. The size is
+** taken first, so that no Lua allocation happens with the file open.
+*/
+static int makekey (lua_State *L, const char *filename, CacheKey *key) {
+  struct stat st;
+  char *src;
+  size_t size;
+  int ok;
+  FILE *f;
+  if (stat(filename, &st) != 0) return 0;
+  size = (size_t)st.st_size;
+  src = (char *)lua_newuserdata(L, size);
+  f = fopen(filename, "rb");
+  if (f == NULL) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  ok = (fread(src, 1, size, f) == size && getc(f) == EOF && !ferror(f) &&
+        fstat(fileno(f), &st) == 0 && (size_t)st.st_size == size);
+  fclose(f);
+  if (!ok) {  /* read error, or file changed while being read */
+    lua_pop(L, 1);
+    return 0;
+  }
+  memset(key, 0, sizeof(CacheKey));  /* keys are compared with 'memcmp' */
+  memcpy(key->magic, CACHEMAGIC, sizeof(CACHEMAGIC));
+  key->hash = hashbytes(2166136261u, src, size);
+  key->mtime = (long)st.st_mtime;
+  key->size = (long)st.st_size;
+  key->optlevel = lua_setoptlevel(L, -1);
+  key->pathlen = strlen(filename);
+  return 1;
+}
+
+
+/*
+** Compile source 'filename', with contents 's', as 'luaL_loadfile'
+** would (skipping a UTF-8 BOM and a first line starting with '#')
+*/
+static int loadsource (lua_State *L, const char *filename,
+                                     const char *s, size_t size) {
+  int status;
+  const char *chunkname = lua_pushfstring(L, "@%s", filename);
+  if (size >= 3 && memcmp(s, "\xEF\xBB\xBF", 3) == 0) {  /* BOM? */
+    s += 3; size -= 3;
+  }
+  if (size > 0 && *s == '#') {  /* first line is a comment? */
+    const char *nl = (const char *)memchr(s, '\n', size);
+    size_t n = (nl == NULL) ? size : (size_t)(nl - s);  /* keep the '\n' */
+    s += n; size -= n;
+  }
+  status = luaL_loadbufferx(L, s, size, chunkname, NULL);
+  lua_remove(L, -2);  /* remove 'chunkname' */
+  return status;
+}
+
+
+/*
+** Name of the cache entry for 'filename' in directory 'dir'
+*/
+static const char *cachename (lua_State *L, const char *dir,
+                                            const char *filename) {
+  char buff[MAXCACHENAME];
+  size_t h = hashbytes(2166136261u, filename, strlen(filename));
+  sprintf(buff, "%lx", (unsigned long)h);
+  return lua_pushfstring(L, "%s" LUA_DIRSEP "%s" CACHESUFFIX, dir, buff);
+}
+
+
+typedef struct LoadC {
+  FILE *f;
+  char buff[BUFSIZ];
+} LoadC;
+
+
+static const char *getC (lua_State *L, void *ud, size_t *size) {
+  LoadC *lc = (LoadC *)ud;
+  (void)L;  /* not used */
+  if (feof(lc->f)) return NULL;
+  *size = fread(lc->buff, 1, sizeof(lc->buff), lc->f);
+  return lc->buff;
+}
+
+
+static int writeC (lua_State *L, const void *b, size_t size, void *ud) {
+  (void)L;  /* not used */
+  return (fwrite(b, size, 1, (FILE *)ud) != 1) && (size != 0);
+}
+
+
+/* read the next 'len' bytes of 'f' and check that they are 'path' */
+static int samepath (FILE *f, const char *path, size_t len) {
+  char buff[256];
+  while (len > 0) {
+    size_t n = (len < sizeof(buff)) ? len : sizeof(buff);
+    if (fread(buff, 1, n, f) != n || memcmp(buff, path, n) != 0)
+      return 0;
+    path += n; len -= n;
+  }
+  return 1;
+}
+
+
+/*
+** Try to load 'filename' from cache entry 'cname'. Returns 1, with the
+** function on the stack, if the entry exists and has the given key.
+*/
+static int readcache (lua_State *L, const char *cname, const CacheKey *key,
+                                    const char *filename) {
+  LoadC lc;
+  CacheKey k;
+  int ok = 0;
+  lc.f = fopen(cname, "rb");
+  if (lc.f == NULL) return 0;
+  if (fread(&k, sizeof(k), 1, lc.f) == 1 &&
+      memcmp(&k, key, sizeof(k)) == 0 &&
+      samepath(lc.f, filename, key->pathlen)) {
+    if (lua_load(L, getC, &lc, cname, "b") == LUA_OK && !ferror(lc.f))
+      ok = 1;
+    else
+      lua_pop(L, 1);  /* damaged entry; ignore it */
+  }
+  fclose(lc.f);
+  return ok;
+}
+
+
+/*
+** Save the function on the top of the stack (compiled from 'filename')
+** as cache entry 'cname'. It is written to a temporary file renamed
+** at the end, so that other processes never see partial entries.
+** Errors are ignored: the entry is simply not created.
+*/
+static void writecache (lua_State *L, const char *cname, const CacheKey *key,
+                                      const char *filename) {
+  const char *tmp = lua_pushfstring(L, "%s.%d", cname, (int)getpid());
+  FILE *f = fopen(tmp, "wb");
+  if (f != NULL) {
+    int err = (fwrite(key, sizeof(CacheKey), 1, f) != 1 ||
+               fwrite(filename, 1, key->pathlen, f) != key->pathlen);
+    lua_pushvalue(L, -2);  /* function to be dumped */
+    if (!err)
+      err = lua_dump(L, writeC, f, 0);
+    lua_pop(L, 1);
+    err |= ferror(f);
+    err |= (fclose(f) != 0);
+    if (err || rename(tmp, cname) != 0)
+      remove(tmp);
+  }
+  lua_pop(L, 1);  /* remove 'tmp' */
+}
+
+
+static int cmpentry (const void *a, const void *b) {
+  long ma = ((const CacheEntry *)a)->mtime;
+  long mb = ((const CacheEntry *)b)->mtime;
+  return (ma > mb) - (ma < mb);
+}
+
+
+/*
+** Eviction: if the entries in directory 'dir' take more than 'limit'
+** bytes, remove the oldest ones until they take at most 3/4 of it.
+** (No Lua allocation here, so that errors cannot leak anything.)
+*/
+static void evictcache (const char *dir, lua_Integer limit) {
+  size_t dirlen = strlen(dir);
+  char *path = (char *)malloc(dirlen + 1 + MAXCACHENAME);
+  CacheEntry *e = NULL;
+  size_t n = 0, size = 0;
+  lua_Integer total = 0;
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  if (path == NULL || d == NULL) {
+    free(path);
+    if (d != NULL) closedir(d);
+    return;
+  }
+  memcpy(path, dir, dirlen);
+  path[dirlen++] = LUA_DIRSEP[0];
+  while ((de = readdir(d)) != NULL) {
+    size_t len = strlen(de->d_name);
+    size_t sl = sizeof(CACHESUFFIX) - 1;
+    struct stat st;
+    if (len >= MAXCACHENAME || len <= sl ||
+        strcmp(de->d_name + len - sl, CACHESUFFIX) != 0)
+      continue;  /* not a cache entry */
+    memcpy(path + dirlen, de->d_name, len + 1);
+    if (stat(path, &st) != 0)
+      continue;
+    if (n == size) {  /* grow array */
+      CacheEntry *ne;
+      size = (size == 0) ? 64 : size * 2;
+      ne = (CacheEntry *)realloc(e, size * sizeof(CacheEntry));
+      if (ne == NULL) break;
+      e = ne;
+    }
+    e[n].mtime = (long)st.st_mtime;
+    e[n].size = (long)st.st_size;
+    memcpy(e[n].name, de->d_name, len + 1);
+    total += e[n++].size;
+  }
+  closedir(d);
+  if (total > limit) {
+    size_t i;
+    qsort(e, n, sizeof(CacheEntry), cmpentry);
+    for (i = 0; i < n && total > limit / 4 * 3; i++) {
+      memcpy(path + dirlen, e[i].name, strlen(e[i].name) + 1);
+      if (remove(path) == 0)
+        total -= e[i].size;
+    }
+  }
+  free(e);
+  free(path);
+}
+
+
+/*
+** Load Lua module 'filename' through the compile cache in directory
+** 'package.cachedir' (if that is a string). Entries are keyed by the
+** path, modification time, size and contents of the source, and by
+** the optimization level; on a miss, the module is compiled (from the
+** same contents that were hashed) and saved.
+*/
+static int loadcached (lua_State *L, const char *filename) {
+  CacheKey key;
+  const char *cname;
+  int status;
+  const char *dir;
+  lua_getfield(L, lua_upvalueindex(1), "cachedir");
+  dir = lua_tostring(L, -1);
+  if (dir == NULL || !makekey(L, filename, &key)) {
+    lua_pop(L, 1);
+    return luaL_loadfile(L, filename);
+  }
+  cname = cachename(L, dir, filename);
+  if (readcache(L, cname, &key, filename))
+    status = LUA_OK;
+  else {
+    status = loadsource(L, filename, (const char *)lua_touserdata(L, -2),
+                        (size_t)key.size);
+    if (status == LUA_OK) {
+      lua_Integer limit;
+      int isnum;
+      writecache(L, cname, &key, filename);
+      lua_getfield(L, lua_upvalueindex(1), "cachesize");
+      limit = lua_tointegerx(L, -1, &isnum);
+      lua_pop(L, 1);
+      evictcache(dir, isnum ? limit : LUA_CACHESIZE);
+    }
+  }
+  lua_remove(L, -2);  /* remove 'cname' */
+  lua_remove(L, -2);  /* remove source */
+  lua_remove(L, -2);  /* remove 'dir' */
+  return status;
+}
+
+#else				/* }{ */
+
+#define loadcached(L,f)		luaL_loadfile(L,f)
+
+#endif				/* } */
+
+
+/*
+** Set 'package.cachedir' from the environment and 'package.cachesize'
+*/
+static void setcache (lua_State *L) {
+  const char *nver = lua_pushfstring(L, "%s%s", LUA_CACHEDIR_VAR,
+                                                LUA_VERSUFFIX);
+  const char *dir = getenv(nver);  /* use versioned name */
+  if (dir == NULL)
+    dir = getenv(LUA_CACHEDIR_VAR);  /* try unversioned name */
+  if (dir != NULL && *dir != '\0' && !noenv(L)) {
+    lua_pushstring(L, dir);
+    lua_setfield(L, -3, "cachedir");
+  }
+  lua_pop(L, 1);  /* pop versioned variable name */
+  lua_pushinteger(L, LUA_CACHESIZE);
+  lua_setfield(L, -2, "cachesize");
+}
+
+/* }====================================================== */
+
+
 static int searcher_Lua (lua_State *L) {
   const char *filename;
   const char *name = luaL_checkstring(L, 1);
   filename = findfile(L, name, "path", LUA_LSUBSEP);
   if (filename == NULL) return 1;  /* module not found in this path */
-  return checkload(L, (luaL_loadfile(L, filename) == LUA_OK), filename);
+  return checkload(L, (loadcached(L, filename) == LUA_OK), filename);
 }
 
 
@@ -775,6 +1126,7 @@ LUAMOD_API int luaopen_package (lua_State *L) {
   /* set paths */
   setpath(L, "path", LUA_PATH_VAR, LUA_PATH_DEFAULT);
   setpath(L, "cpath", LUA_CPATH_VAR, LUA_CPATH_DEFAULT);
+  setcache(L);
   /* store config information */
   lua_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
                      LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
@@ -389,6 +389,7 @@ typedef struct Upvaldesc {
   TString *name;  /* upvalue name (for debug information) */
   lu_byte instack;  /* whether it is in stack (register) */
   lu_byte idx;  /* index of upvalue (in stack or in outer function's list) */
+  lu_byte kind;  /* kind of the variable (used only by the parser) */
 } Upvaldesc;
 
 
@@ -403,6 +404,46 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** Associates the absolute line source for a given instruction ('pc').
+** The array 'lineinfo' gives, for each instruction, the difference in
+** lines from the previous instruction. When that difference does not
+** fit into a byte, Lua saves the absolute line for that instruction.
+** (Lua also saves the absolute line periodically, to speed up the
+** computation of a line number: we can use binary search in the
+** absolute-line array, but we must traverse the 'lineinfo' array
+** linearly to compute a line.)
+*/
+typedef struct AbsLineInfo {
+  int pc;
+  int line;
+} AbsLineInfo;
+
+
+/*
+** Memory image of a precompiled chunk holding the code and line
+** information of its prototypes (see 'lua_loadimage')
+*/
+typedef struct ChunkImage {
+  void *buff;
+  size_t size;
+  lua_Release release;  /* called when no prototype uses the image */
+  void *ud;  /* auxiliary data to 'release' */
+  int nref;  /* number of prototypes using the image */
+} ChunkImage;
+
+
+/*
+** Entry of the global cache of a prototype: where constant 'k[i]' was
+** found in table 't' (while 't' keeps version 'version')
+*/
+typedef struct GlobalCache {
+  struct Table *t;
+  lu_mem version;
+  const TValue *slot;
+} GlobalCache;
+
+
 /*
 ** Function Prototypes
 ** 主要存放二进制的字节码指令集(Opcode),字节码指令集主要存储在code的数组上
@@ -419,6 +460,7 @@ typedef struct Proto {
   int sizek;  /* size of 'k' */
   int sizecode;  /* code个数 */
   int sizelineinfo;
+  int sizeabslineinfo;  /* size of 'abslineinfo' */
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int linedefined;  /* debug information  */
@@ -426,10 +468,21 @@ typedef struct Proto {
   TValue *k;  /* constants used by the function - 常量表 */
   Instruction *code;  /* opcodes - 存储指令集数组 */
   struct Proto **p;  /* functions defined inside the function */
-  int *lineinfo;  /* map from opcodes to source lines (debug information) */
+  ls_byte *lineinfo;  /* information about source lines (debug information) */
+  AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   struct LClosure *cache;  /* last-created closure with this prototype */
+  struct JitCode *jit;  /* native code for this function (see ljit.c) */
+  ChunkImage *image;  /* image holding code and line information (or NULL) */
+  size_t debuginfo;  /* offset in 'image' of names not loaded yet (or 0) */
+  int jitcount;  /* calls/loop iterations left before compiling it */
+#if defined(LUAI_OPSTATS)
+  lu_mem *hits;  /* executions of each instruction (created on first run) */
+#endif
+#if !defined(LUAI_NOGCACHE)
+  GlobalCache *gcache;  /* one entry per constant (created on first use) */
+#endif
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -528,6 +581,9 @@ typedef struct Table {
   Node *lastfree;  /* any free position is before this position - Hash节点,指向Hash表的最后一个空闲节点 */
   struct Table *metatable;  /* 元表,用于重载操作 */
   GCObject *gclist;
+#if !defined(LUAI_NOGCACHE)
+  lu_mem version;  /* changes whenever an entry may move (see lvm.c) */
+#endif
 } Table;
 
 
@@ -66,6 +66,18 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "ADDI",
+  "ADDK",
+  "EQK",
+  "LTI",
+  "LEI",
+  "GTI",
+  "GEI",
+  "GETTABUPF",
+  "GETTABLEF",
+  "ADDII",
+  "GETTABLEAI",
+  "LENT",
   NULL
 };
 
@@ -121,5 +133,59 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_ADDI */
+ ,opmode(0, 1, OpArgR, OpArgU, iABC)		/* OP_ADDK */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_EQK */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_LTI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_LEI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_GTI */
+ ,opmode(1, 0, OpArgR, OpArgU, iABC)		/* OP_GEI */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETTABUPF */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLEF */
+ ,opmode(0, 1, OpArgR, OpArgR, iABC)		/* OP_ADDII */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLEAI */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_LENT */
 };
 
+
+/*
+** Superinstruction pass: mark instructions that can execute the
+** instruction following them in the same dispatch. Only the first
+** instruction of each pair changes; the second one is kept as is,
+** so that jumps into it and hooks still see regular code. Can be
+** turned off (e.g., to debug the code generator) by defining
+** LUAI_NOFUSION.
+*/
+void luaP_fuse (Instruction *code, int n) {
+#if !defined(LUAI_NOFUSION)
+  int pc;
+  for (pc = 0; pc < n - 1; pc++) {
+    if (GET_OPCODE(luaP_generic(code[pc + 1])) == OP_GETTABLE) {
+      switch (GET_OPCODE(code[pc])) {
+        case OP_GETTABUP: SET_OPCODE(code[pc], OP_GETTABUPF); break;
+        case OP_GETTABLE: SET_OPCODE(code[pc], OP_GETTABLEF); break;
+        default: break;
+      }
+    }
+  }
+#else
+  UNUSED(code); UNUSED(n);
+#endif
+}
+
+
+/*
+** Return the generic form of instruction 'i', undoing fusions and
+** quickening. This is the form saved in precompiled chunks.
+*/
+Instruction luaP_generic (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_GETTABUPF: SET_OPCODE(i, OP_GETTABUP); break;
+    case OP_GETTABLEF: case OP_GETTABLEAI: SET_OPCODE(i, OP_GETTABLE); break;
+    case OP_ADDII: SET_OPCODE(i, OP_ADD); break;
+    case OP_LENT: SET_OPCODE(i, OP_LEN); break;
+    default: break;
+  }
+  return i;
+}
+
@@ -75,6 +75,9 @@ enum OpMode {iABC, iABx, iAsBx, iAx};  /* basic instruction format */
 #define MAXARG_B        ((1<<SIZE_B)-1)
 #define MAXARG_C        ((1<<SIZE_C)-1)
 
+/* 'sC' is signed (immediate operands of OP_ADDI and OP_LTI-like opcodes) */
+#define MAXARG_sC	(MAXARG_C >> 1)
+
 
 /* creates a mask with 'n' 1 bits at position 'p' */
 #define MASK1(n,p)	((~((~(Instruction)0)<<(n)))<<(p))
@@ -112,6 +115,12 @@ enum OpMode {iABC, iABx, iAsBx, iAx};  /* basic instruction format */
 #define GETARG_sBx(i)	(GETARG_Bx(i)-MAXARG_sBx)
 #define SETARG_sBx(i,b)	SETARG_Bx((i),cast(unsigned int, (b)+MAXARG_sBx))
 
+#define GETARG_sC(i)	(GETARG_C(i)-MAXARG_sC)
+#define int2sC(i)	((i)+MAXARG_sC)
+
+/* test whether integer 'i' fits in a 'sC' argument */
+#define fitsC(i)	(-MAXARG_sC <= (i) && (i) <= MAXARG_C - MAXARG_sC)
+
 
 /*
 ** 宏生成操作指令
@@ -233,11 +242,26 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+OP_ADDI,/*	A B sC	R(A) := R(B) + sC				*/
+OP_ADDK,/*	A B C	R(A) := R(B) + Kst(C)				*/
+OP_EQK,/*	A B C	if ((R(B) == Kst(C)) ~= A) then pc++		*/
+OP_LTI,/*	A B sC	if ((R(B) <  sC) ~= A) then pc++		*/
+OP_LEI,/*	A B sC	if ((R(B) <= sC) ~= A) then pc++		*/
+OP_GTI,/*	A B sC	if ((R(B) >  sC) ~= A) then pc++		*/
+OP_GEI,/*	A B sC	if ((R(B) >= sC) ~= A) then pc++		*/
+
+OP_GETTABUPF,/*	A B C	R(A) := UpValue[B][RK(C)]; then next GETTABLE	*/
+OP_GETTABLEF,/*	A B C	R(A) := R(B)[RK(C)]; then next GETTABLE		*/
+
+OP_ADDII,/*	A B C	R(A) := R(B) + R(C) (integers)				*/
+OP_GETTABLEAI,/* A B C	R(A) := R(B)[RK(C)] (array part, integer key)	*/
+OP_LENT/*	A B	R(A) := length of R(B) (a table)			*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)  /* 操作指令从0开始计算,所以总的值是OP_EXTRAARG + 1 */
+#define NUM_OPCODES	(cast(int, OP_LENT) + 1)  /* 操作指令从0开始计算,所以总的值是OP_LENT + 1 */
 
 
 
@@ -260,6 +284,27 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   (*) For comparisons, A specifies what condition the test should accept
   (true or false).
 
+  (*) Opcodes after OP_EXTRAARG are specialized forms of the generic
+  ones, emitted by the code generator when an operand is a numeric
+  constant; they keep precompiled chunks of the standard opcodes
+  loadable. In OP_GTI and OP_GEI the immediate is the left operand of
+  the original comparison ('sC < R(B)' and 'sC <= R(B)'), which matters
+  for metamethods and error messages.
+
+  (*) OP_GETTABUPF and OP_GETTABLEF are "fused" instructions: they
+  behave as OP_GETTABUP/OP_GETTABLE and then execute the OP_GETTABLE
+  that follows them without a new dispatch. The following instruction
+  is kept unchanged, so it is still a valid jump target. They are
+  created by 'luaP_fuse' and are never saved in precompiled chunks
+  (see 'luaP_generic').
+
+  (*) OP_ADDII, OP_GETTABLEAI and OP_LENT are "quickened" instructions:
+  the interpreter rewrites an OP_ADD, OP_GETTABLE or OP_LEN in place
+  into them after executing it with the operand types they expect (an
+  OP_ADD only with register operands), and rewrites them back when those
+  types change (a type miss). Like fused instructions, they are never
+  saved in precompiled chunks.
+
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
 ===========================================================================*/
@@ -297,4 +342,8 @@ LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 #define LFIELDS_PER_FLUSH	50
 
 
+LUAI_FUNC void luaP_fuse (Instruction *code, int n);
+LUAI_FUNC Instruction luaP_generic (Instruction i);
+
+
 #endif
@@ -27,6 +27,7 @@
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
+#include "lvm.h"
 
 
 
@@ -50,6 +51,7 @@ typedef struct BlockCnt {
   struct BlockCnt *previous;  /* chain */
   int firstlabel;  /* index of first label in this block */
   int firstgoto;  /* index of first pending goto in this block */
+  int firstcst;  /* index of first compile-time constant in this block */
   lu_byte nactvar;  /* # active locals outside the block */
   lu_byte upval;  /* true if some variable in the block is an upvalue */
   lu_byte isloop;  /* true if 'block' is a loop */
@@ -184,7 +186,8 @@ static void new_localvar (LexState *ls, TString *name) {
                   MAXVARS, "local variables");
   luaM_growvector(ls->L, dyd->actvar.arr, dyd->actvar.n + 1,
                   dyd->actvar.size, Vardesc, MAX_INT, "local variables");
-  dyd->actvar.arr[dyd->actvar.n++].idx = cast(short, reg);
+  dyd->actvar.arr[dyd->actvar.n].idx = cast(short, reg);
+  dyd->actvar.arr[dyd->actvar.n++].kind = VDKREG;
 }
 
 
@@ -196,6 +199,11 @@ static void new_localvarliteral_ (LexState *ls, const char *name, size_t sz) {
 	new_localvarliteral_(ls, "" v, (sizeof(v)/sizeof(char))-1)
 
 
+static Vardesc *getvardesc (FuncState *fs, int i) {
+  return &fs->ls->dyd->actvar.arr[fs->firstlocal + i];
+}
+
+
 static LocVar *getlocvar (FuncState *fs, int i) {
   int idx = fs->ls->dyd->actvar.arr[fs->firstlocal + i].idx;
   lua_assert(idx < fs->nlocvars);
@@ -240,6 +248,12 @@ static int newupvalue (FuncState *fs, TString *name, expdesc *v) {
   f->upvalues[fs->nups].instack = (v->k == VLOCAL);
   f->upvalues[fs->nups].idx = cast_byte(v->u.info);
   f->upvalues[fs->nups].name = name;
+  if (fs->prev == NULL)  /* environment of the main function? */
+    f->upvalues[fs->nups].kind = VDKREG;
+  else if (v->k == VLOCAL)
+    f->upvalues[fs->nups].kind = getvardesc(fs->prev, v->u.info)->kind;
+  else
+    f->upvalues[fs->nups].kind = fs->prev->f->upvalues[v->u.info].kind;
   luaC_objbarrier(fs->ls->L, f, name);
   return fs->nups++;
 }
@@ -255,6 +269,21 @@ static int searchvar (FuncState *fs, TString *n) {
 }
 
 
+/*
+  Find the compile-time constant with given name visible at the current
+  level, unless the local variable 'v' (or -1) was declared after it.
+*/
+static int searchconst (FuncState *fs, TString *n, int v) {
+  Dyndata *dyd = fs->ls->dyd;
+  int i;
+  for (i = dyd->cst.n - 1; i >= fs->firstcst; i--) {
+    if (eqstr(n, dyd->cst.arr[i].name))
+      return (v < dyd->cst.arr[i].nactvar) ? i : -1;
+  }
+  return -1;  /* not found */
+}
+
+
 /*
   Mark block where variable at given level was defined
   (to emit close instructions later).
@@ -283,7 +312,10 @@ static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
     init_exp(var, VVOID, 0);  /* default is global - 全局变量 */
   else {
     int v = searchvar(fs, n);  /* look up locals at current level - 从函数局部变量中查找局部变量值 */
-    if (v >= 0) {  /* found? */
+    int c = searchconst(fs, n, v);
+    if (c >= 0)  /* a compile-time constant hides it? */
+      init_exp(var, VCONST, c);  /* no register, no upvalue */
+    else if (v >= 0) {  /* found? */
       init_exp(var, VLOCAL, v);  /* variable is local - 局部变量 */
       if (!base)
         markupval(fs, v);  /* local will be used as an upval */
@@ -292,8 +324,8 @@ static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
       int idx = searchupvalue(fs, n);  /* try existing upvalues - 查询全局变量,如果没有找到全局变量,则newupvalue重新生成 */
       if (idx < 0) {  /* not found? */
         singlevaraux(fs->prev, n, var, 0);  /* try upper levels */
-        if (var->k == VVOID)  /* not found? */
-          return;  /* it is a global */
+        if (var->k == VVOID || var->k == VCONST)  /* global or constant? */
+          return;
         /* else was LOCAL or UPVAL */
         idx  = newupvalue(fs, n, var);  /* will be a new upvalue */
       }
@@ -315,6 +347,8 @@ static void singlevar (LexState *ls, expdesc *var) {
     expdesc key;
     singlevaraux(fs, ls->envn, var, 1);  /* get environment variable */
     lua_assert(var->k != VVOID);  /* this one must exist */
+    if (var->k == VCONST)  /* '_ENV' is a compile-time constant? */
+      luaK_exp2anyregup(fs, var);  /* put it in a register */
     codestring(ls, &key, varname);  /* key is variable name */
     luaK_indexed(fs, var, &key);  /* env[varname] */
   }
@@ -456,6 +490,7 @@ static void enterblock (FuncState *fs, BlockCnt *bl, lu_byte isloop) {
   bl->nactvar = fs->nactvar;
   bl->firstlabel = fs->ls->dyd->label.n;
   bl->firstgoto = fs->ls->dyd->gt.n;
+  bl->firstcst = fs->ls->dyd->cst.n;
   bl->upval = 0;
   bl->previous = fs->bl;
   fs->bl = bl;
@@ -501,6 +536,7 @@ static void leaveblock (FuncState *fs) {
   lua_assert(bl->nactvar == fs->nactvar);
   fs->freereg = fs->nactvar;  /* free registers */
   ls->dyd->label.n = bl->firstlabel;  /* remove local labels */
+  ls->dyd->cst.n = bl->firstcst;  /* remove local constants */
   if (bl->previous)  /* inner block? */
     movegotosout(fs, bl);  /* update pending gotos to outer block */
   else if (bl->firstgoto < ls->dyd->gt.n)  /* pending gotos in outer block? */
@@ -553,9 +589,13 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->nk = 0;
   fs->np = 0;
   fs->nups = 0;
+  fs->previousline = fs->f->linedefined;
+  fs->iwthabs = 0;
+  fs->nabslineinfo = 0;
   fs->nlocvars = 0;
   fs->nactvar = 0;
   fs->firstlocal = ls->dyd->actvar.n;
+  fs->firstcst = ls->dyd->cst.n;
   fs->bl = NULL;
   f = fs->f;
   f->source = ls->source;
@@ -570,10 +610,15 @@ static void close_func (LexState *ls) {
   Proto *f = fs->f;
   luaK_ret(fs, 0, 0);  /* final return */
   leaveblock(fs);
+  luaK_optimize(fs);  /* optional passes over the finished code */
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
-  luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
+  luaP_fuse(f->code, f->sizecode);  /* code is final; create superinstructions */
+  luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, ls_byte);
   f->sizelineinfo = fs->pc;
+  luaM_reallocvector(L, f->abslineinfo, f->sizeabslineinfo,
+                       fs->nabslineinfo, AbsLineInfo);
+  f->sizeabslineinfo = fs->nabslineinfo;
   luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
   f->sizek = fs->nk;
   luaM_reallocvector(L, f->p, f->sizep, fs->np, Proto *);
@@ -1008,6 +1053,8 @@ static void simpleexp (LexState *ls, expdesc *v) {
     }
     default: {
       suffixedexp(ls, v);
+      if (v->k == VCONST)  /* use its value, so it can be folded */
+        luaK_dischargevars(ls->fs, v);
       return;
     }
   }
@@ -1142,6 +1189,36 @@ struct LHS_assign {
 };
 
 
+/*
+** Raise an error if expression 'e' is a '<const>' variable.
+*/
+static void check_readonly (LexState *ls, expdesc *e) {
+  FuncState *fs = ls->fs;
+  TString *varname = NULL;
+  switch (e->k) {
+    case VCONST: {
+      varname = ls->dyd->cst.arr[e->u.info].name;
+      break;
+    }
+    case VLOCAL: {
+      if (getvardesc(fs, e->u.info)->kind != VDKREG)
+        varname = getlocvar(fs, e->u.info)->varname;
+      break;
+    }
+    case VUPVAL: {
+      Upvaldesc *up = &fs->f->upvalues[e->u.info];
+      if (up->kind != VDKREG)
+        varname = up->name;
+      break;
+    }
+    default: return;  /* other cases cannot be read-only */
+  }
+  if (varname)
+    semerror(ls, luaO_pushfstring(ls->L,
+                 "attempt to assign to const variable '%s'", getstr(varname)));
+}
+
+
 /*
 ** check whether, in an assignment to an upvalue/local variable, the
 ** upvalue/local variable is begin used in a previous assignment to a
@@ -1186,6 +1263,7 @@ static void check_conflict (LexState *ls, struct LHS_assign *lh, expdesc *v) {
 */
 static void assignment (LexState *ls, struct LHS_assign *lh, int nvars) {
   expdesc e;
+  check_readonly(ls, &lh->v);
   check_condition(ls, vkisvar(lh->v.k), "syntax error");
   if (testnext(ls, ',')) {  /* assignment -> ',' suffixedexp assignment */
     struct LHS_assign nv;
@@ -1496,13 +1574,56 @@ static void localfunc (LexState *ls) {
 }
 
 
+static int getlocalattribute (LexState *ls) {
+  /* ATTRIB -> ['<' NAME '>'] */
+  if (testnext(ls, '<')) {
+    const char *attr = getstr(str_checkname(ls));
+    checknext(ls, '>');
+    if (strcmp(attr, "const") == 0)
+      return RDKCONST;  /* read-only variable */
+    semerror(ls, luaO_pushfstring(ls->L, "unknown attribute '%s'", attr));
+  }
+  return VDKREG;  /* regular variable */
+}
+
+
+/*
+** Turn the last variable declared, a '<const>' initialized with the
+** constant 'k', into a compile-time constant: it leaves the list of
+** active variables (and the debug information) for the list of
+** constants, so it uses no register.
+*/
+static void newconst (LexState *ls, const TValue *k) {
+  FuncState *fs = ls->fs;
+  Dyndata *dyd = ls->dyd;
+  Constdesc *c;
+  TString *name = getlocvar(fs, dyd->actvar.n - 1 - fs->firstlocal)->varname;
+  lua_assert(getvardesc(fs, dyd->actvar.n - 1 - fs->firstlocal)->idx ==
+             fs->nlocvars - 1);
+  dyd->actvar.n--;
+  fs->nlocvars--;
+  luaM_growvector(ls->L, dyd->cst.arr, dyd->cst.n + 1, dyd->cst.size,
+                  Constdesc, MAX_INT, "constants");
+  c = &dyd->cst.arr[dyd->cst.n++];
+  c->name = name;
+  setobj(ls->L, &c->k, k);
+  c->nactvar = fs->nactvar;
+}
+
+
 static void localstat (LexState *ls) {
-  /* stat -> LOCAL NAME {',' NAME} ['=' explist] */
+  /* stat -> LOCAL NAME ATTRIB {',' NAME ATTRIB} ['=' explist] */
+  FuncState *fs = ls->fs;
   int nvars = 0;
   int nexps;
+  int kind;
   expdesc e;
+  TValue k;
   do {
     new_localvar(ls, str_checkname(ls));
+    kind = getlocalattribute(ls);
+    getvardesc(fs, ls->dyd->actvar.n - 1 - fs->firstlocal)->kind =
+        cast_byte(kind);
     nvars++;
   } while (testnext(ls, ','));
   if (testnext(ls, '='))
@@ -1511,8 +1632,15 @@ static void localstat (LexState *ls) {
     e.k = VVOID;
     nexps = 0;
   }
-  adjust_assign(ls, nvars, nexps, &e);
-  adjustlocalvars(ls, nvars);
+  if (nvars == nexps && kind == RDKCONST &&  /* last one is constant? */
+      luaK_exp2const(fs, &e, &k)) {  /* with a constant value? */
+    adjustlocalvars(ls, nvars - 1);  /* others are regular variables */
+    newconst(ls, &k);
+  }
+  else {
+    adjust_assign(ls, nvars, nexps, &e);
+    adjustlocalvars(ls, nvars);
+  }
 }
 
 
@@ -1536,6 +1664,7 @@ static void funcstat (LexState *ls, int line) {
   expdesc v, b;
   luaX_next(ls);  /* skip FUNCTION */
   ismethod = funcname(ls, &v);
+  check_readonly(ls, &v);
   body(ls, &b, ismethod, line);
   luaK_storevar(ls->fs, &v, &b);
   luaK_fixline(ls->fs, line);  /* definition "happens" in the first line */
@@ -1726,13 +1855,292 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   lua_assert(iswhite(funcstate.f));  /* do not need barrier here */
   lexstate.buff = buff;
   lexstate.dyd = dyd;
-  dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+  dyd->actvar.n = dyd->cst.n = dyd->gt.n = dyd->label.n = 0;
   luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);  /* 用于执行语法树的解析工作 */
   lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
   /* all scopes should be correctly finished */
-  lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
+  lua_assert(dyd->actvar.n == 0 && dyd->cst.n == 0 &&
+             dyd->gt.n == 0 && dyd->label.n == 0);
   L->top--;  /* remove scanner's table */
   return cl;  /* closure is on the stack, too */
 }
 
+
+/*
+** {======================================================================
+** Data chunks ('d' in the mode of 'lua_load'): a chunk 'return value',
+** where 'value' is built only from literals and table constructors, is
+** evaluated while it is parsed, with no code generation. The value
+** lives in an upvalue of the resulting closure, and 'lua_dump' does not
+** save upvalue values: a dumped data chunk returns nil when loaded.
+** =======================================================================
+*/
+
+
+typedef struct DataCons {
+  Table *t;  /* table being built */
+  int na;  /* number of list items */
+  int nh;  /* number of record items */
+  int tostore;  /* number of fields (key-value pairs) at the stack top */
+  int nlist;  /* number of list items among them */
+} DataCons;
+
+
+static void datavalue (LexState *ls);
+
+
+static void datalimit (LexState *ls, int v, int l, const char *what) {
+  if (v > l)
+    luaX_syntaxerror(ls, luaO_pushfstring(ls->L,
+                         "too many %s (limit is %d) in data", what, l));
+}
+
+
+/*
+** Record items stay pending until the constructor closes, when the
+** final sizes of both parts are known, so that the table gets the same
+** layout (and traversal order) as in regular code. Only constructors
+** with more than this many record items store them earlier.
+*/
+#if !defined(LUAI_MAXDATAREC)
+#define LUAI_MAXDATAREC		1000
+#endif
+
+
+/* true if 'k' is an integer key in the interval (lo, hi] */
+static int inbatch (const TValue *k, lua_Integer lo, lua_Integer hi) {
+  lua_Integer i;
+  return (ttisnumber(k) && luaV_tointeger(k, &i, 0) && lo < i && i <= hi);
+}
+
+
+/*
+** Store the pending list items (pairs with a nil key) as a batch, as
+** OP_SETLIST does. A pending record item with a key in the batch would
+** be overwritten by it in regular code, so it is dropped.
+*/
+static void datalist (lua_State *L, DataCons *dc) {
+  Table *t = dc->t;
+  int first = dc->na - dc->nlist;  /* number of items already stored */
+  StkId base = L->top - 2 * dc->tostore;  /* first pending field */
+  StkId r = base;  /* where to keep pending record items */
+  StkId f;
+  TValue *a;
+  if (cast(unsigned int, dc->na) > t->sizearray)  /* array too small? */
+    luaH_resizearray(L, t, 2 * cast(unsigned int, dc->na));
+  a = &t->array[first];
+  for (f = base; f < L->top; f += 2) {
+    if (ttisnil(f)) {  /* list item? */
+      setobj2t(L, a++, f + 1);
+      luaC_barrierback(L, t, f + 1);
+    }
+    else if (!inbatch(f, first, dc->na)) {  /* record item to keep? */
+      setobj2s(L, r, f);
+      setobj2s(L, r + 1, f + 1);
+      r += 2;
+    }
+  }
+  L->top = r;
+  dc->tostore = cast_int(r - base) / 2;
+  dc->nlist = 0;
+}
+
+
+/*
+** Store the pending record items, keeping list items pending.
+*/
+static void datarecords (lua_State *L, DataCons *dc) {
+  Table *t = dc->t;
+  StkId f = L->top - 2 * dc->tostore;  /* first pending field */
+  StkId l = f;  /* where to keep pending list items */
+  if (dc->nh > allocsizenode(t))  /* hash part too small? */
+    luaH_resize(L, t, t->sizearray, 2 * cast(unsigned int, dc->nh));
+  for (; f < L->top; f += 2) {
+    if (!ttisnil(f)) {  /* record item? */
+      setobj2t(L, luaH_set(L, t, f), f + 1);
+      luaC_barrierback(L, t, f + 1);
+    }
+    else {  /* list item; keep it */
+      setnilvalue(l);
+      setobj2s(L, l + 1, f + 1);
+      l += 2;
+    }
+  }
+  L->top = l;
+  dc->tostore = dc->nlist;
+}
+
+
+/*
+** Give the table the sizes OP_NEWTABLE would give it and store all
+** pending fields.
+*/
+static void closedata (lua_State *L, DataCons *dc) {
+  Table *t = dc->t;
+  unsigned int na = cast(unsigned int, luaO_fb2int(luaO_int2fb(dc->na)));
+  unsigned int nh = cast(unsigned int, luaO_fb2int(luaO_int2fb(dc->nh)));
+  unsigned int hsize = (nh == 0) ? 0 : 1u << luaO_ceillog2(nh);
+  if (t->sizearray != na || cast(unsigned int, allocsizenode(t)) != hsize)
+    luaH_resize(L, t, na, nh);
+  datalist(L, dc);
+  datarecords(L, dc);
+}
+
+
+static void datafield (LexState *ls, DataCons *dc) {
+  /* field -> NAME '=' value | '[' value ']' '=' value | value */
+  lua_State *L = ls->L;
+  datalimit(ls, dc->na + dc->nh, MAX_INT - 1, "items in a constructor");
+  switch (ls->t.token) {
+    case TK_NAME: {
+      luaD_checkstack(L, 1);
+      setsvalue2s(L, L->top, ls->t.seminfo.ts);
+      L->top++;
+      luaX_next(ls);
+      checknext(ls, '=');
+      dc->nh++;
+      break;
+    }
+    case '[': {
+      luaX_next(ls);
+      datavalue(ls);
+      checknext(ls, ']');
+      if (ttisnil(L->top - 1))
+        semerror(ls, "table index is nil");
+      checknext(ls, '=');
+      dc->nh++;
+      break;
+    }
+    default: {
+      luaD_checkstack(L, 1);
+      setnilvalue(L->top);  /* no key */
+      L->top++;
+      dc->na++;
+      dc->nlist++;
+      break;
+    }
+  }
+  datavalue(ls);
+  dc->tostore++;
+}
+
+
+static void dataconstructor (LexState *ls) {
+  /* constructor -> '{' [ field { sep field } [sep] ] '}'
+     sep -> ',' | ';' */
+  lua_State *L = ls->L;
+  int line = ls->linenumber;
+  DataCons dc;
+  dc.t = luaH_new(L);
+  dc.na = dc.nh = dc.tostore = dc.nlist = 0;
+  sethvalue(L, L->top, dc.t);  /* anchor it */
+  L->top++;
+  checknext(ls, '{');
+  do {
+    if (ls->t.token == '}') break;
+    if (dc.nlist == LFIELDS_PER_FLUSH)
+      datalist(L, &dc);
+    else if (dc.tostore - dc.nlist == LUAI_MAXDATAREC)
+      datarecords(L, &dc);
+    datafield(ls, &dc);
+  } while (testnext(ls, ',') || testnext(ls, ';'));
+  check_match(ls, '}', '{', line);
+  closedata(L, &dc);
+}
+
+
+/*
+** Push the value of the expression starting at the current token. A
+** numeral may be negated, as unary minus over constants is folded in
+** regular code too.
+*/
+static void datavalue (LexState *ls) {
+  lua_State *L = ls->L;
+  datalimit(ls, ++L->nCcalls, LUAI_MAXCCALLS, "C levels");
+  luaD_checkstack(L, 1);
+  switch (ls->t.token) {
+    case TK_NIL: setnilvalue(L->top); break;
+    case TK_TRUE: setbvalue(L->top, 1); break;
+    case TK_FALSE: setbvalue(L->top, 0); break;
+    case TK_INT: setivalue(L->top, ls->t.seminfo.i); break;
+    case TK_FLT: setfltvalue(L->top, ls->t.seminfo.r); break;
+    case TK_STRING: setsvalue2s(L, L->top, ls->t.seminfo.ts); break;
+    case '{': {
+      dataconstructor(ls);
+      L->nCcalls--;
+      return;
+    }
+    case '-': {
+      luaX_next(ls);
+      datavalue(ls);
+      if (!ttisnumber(L->top - 1))
+        semerror(ls, "number expected after unary minus in data");
+      luaO_arith(L, LUA_OPUNM, L->top - 1, L->top - 1, L->top - 1);
+      L->nCcalls--;
+      return;
+    }
+    default: {
+      luaX_syntaxerror(ls, "unexpected symbol in data");
+    }
+  }
+  L->top++;
+  luaC_checkGC(L);
+  luaX_next(ls);
+  L->nCcalls--;
+}
+
+
+/*
+** Parses a data chunk into a main closure that returns the value; its
+** upvalues are already initialized: LUA_ENV, as in regular chunks, and
+** the value.
+*/
+LClosure *luaY_parsedata (lua_State *L, ZIO *z, Mbuffer *buff,
+                          const char *name, int firstchar) {
+  LexState lexstate;
+  LClosure *cl = luaF_newLclosure(L, 2);
+  Proto *f;
+  setclLvalue(L, L->top, cl);  /* anchor it (to avoid being collected) */
+  luaD_inctop(L);
+  f = cl->p = luaF_newproto(L);
+  f->source = luaS_new(L, name);  /* create and anchor TString */
+  lua_assert(iswhite(f));  /* do not need barrier here */
+  lexstate.h = luaH_new(L);  /* create table for scanner */
+  sethvalue(L, L->top, lexstate.h);  /* anchor it */
+  luaD_inctop(L);
+  lexstate.buff = buff;
+  lexstate.dyd = NULL;
+  luaX_setinput(L, &lexstate, z, f->source, firstchar);
+  lexstate.isdata = 1;
+  luaX_next(&lexstate);
+  checknext(&lexstate, TK_RETURN);
+  datavalue(&lexstate);
+  testnext(&lexstate, ';');
+  check(&lexstate, TK_EOS);
+  f->is_vararg = 1;  /* main function is always declared vararg */
+  f->maxstacksize = 2;
+  f->code = luaM_newvector(L, 2, Instruction);
+  f->sizecode = 2;
+  f->code[0] = CREATE_ABC(OP_GETUPVAL, 0, 1, 0);
+  f->code[1] = CREATE_ABC(OP_RETURN, 0, 2, 0);
+  f->upvalues = luaM_newvector(L, 2, Upvaldesc);
+  f->sizeupvalues = 2;
+  f->upvalues[0].name = lexstate.envn;
+  f->upvalues[0].instack = 1;
+  f->upvalues[0].idx = 0;
+  f->upvalues[0].kind = VDKREG;
+  f->upvalues[1].name = NULL;
+  f->upvalues[1].instack = 0;
+  f->upvalues[1].idx = 1;
+  f->upvalues[1].kind = VDKREG;
+  luaC_objbarrier(L, f, lexstate.envn);
+  luaF_initupvals(L, cl);
+  setobj(L, cl->upvals[1]->v, L->top - 1);
+  luaC_upvalbarrier(L, cl->upvals[1]);
+  L->top -= 2;  /* remove value and scanner's table */
+  return cl;  /* closure is on the stack, too */
+}
+
+/* }====================================================================== */
+
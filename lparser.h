@@ -31,6 +31,8 @@ typedef enum {
   VK,  /* constant in 'k'; info = index of constant in 'k' */
   VKFLT,  /* floating constant; nval = numerical float value */
   VKINT,  /* integer constant; nval = numerical integer value */
+  VCONST,  /* compile-time constant variable;
+              info = index of constant in 'dyd->cst' */
   VNONRELOC,  /* expression has its value in a fixed register;
                  info = result register */
   VLOCAL,  /* local variable; info = local register */
@@ -68,12 +70,29 @@ typedef struct expdesc {
 } expdesc;
 
 
+/* kinds of variables */
+#define VDKREG		0   /* regular */
+#define RDKCONST	1   /* constant ('<const>' attribute) */
+
+
 /* description of active local variable */
 typedef struct Vardesc {
   short idx;  /* variable index in stack */
+  lu_byte kind;
 } Vardesc;
 
 
+/*
+** description of a compile-time constant: a '<const>' local initialized
+** with a constant expression, which gets no register
+*/
+typedef struct Constdesc {
+  TString *name;
+  TValue k;  /* constant value */
+  lu_byte nactvar;  /* active local variables when it was declared */
+} Constdesc;
+
+
 /* description of pending goto statements and label statements */
 typedef struct Labeldesc {
   TString *name;  /* label identifier */
@@ -98,6 +117,11 @@ typedef struct Dyndata {
     int n;
     int size;
   } actvar;
+  struct {  /* list of active compile-time constants */
+    Constdesc *arr;
+    int n;
+    int size;
+  } cst;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
 } Dyndata;
@@ -122,15 +146,21 @@ typedef struct FuncState {
   int nk;  /* number of elements in 'k' */
   int np;  /* number of elements in 'p' */
   int firstlocal;  /* index of first local var (in Dyndata array) */
+  int firstcst;  /* index of first compile-time constant (in Dyndata) */
+  int previousline;  /* last line that was saved in 'lineinfo' */
+  int nabslineinfo;  /* number of elements in 'abslineinfo' */
   short nlocvars;  /* number of elements in 'f->locvars' */
   lu_byte nactvar;  /* number of active local variables */
   lu_byte nups;  /* number of upvalues */
   lu_byte freereg;  /* first free register */
+  lu_byte iwthabs;  /* instructions issued since last absolute line info */
 } FuncState;
 
 
 LUAI_FUNC LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
                                  Dyndata *dyd, const char *name, int firstchar);
+LUAI_FUNC LClosure *luaY_parsedata (lua_State *L, ZIO *z, Mbuffer *buff,
+                                    const char *name, int firstchar);
 
 
 #endif
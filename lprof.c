@@ -0,0 +1,837 @@
+/*
+** $Id: lprof.c $
+** Profilers and heap snapshots
+** See Copyright Notice in lua.h
+*/
+
+#define lprof_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldebug.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lprof.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+
+
+/* limit for the size of a profile (in distinct stacks) */
+#define MAXPROFSTACKS	(1 << 20)
+
+
+/*
+** A timer (a signal handler or another thread) only sets the bit
+** PROFMASK in the hook mask of the running thread, through
+** 'lua_profsample'. Like a count hook, the bit makes the interpreter
+** (or native code, at back edges and after calls) stop before its
+** next instruction; a C function checks it when it returns. The
+** thread then records its own call stack ('luaR_sample'). So, stacks
+** are walked only at safe points, the profile table has a single
+** writer and needs no locks, taking a sample allocates nothing, and
+** there is no cost when no sample is pending. Protos kept in the
+** profile are marked by the collector (see 'atomic' in lgc.c).
+*/
+
+
+static unsigned int hashframes (const ProfFrame *fr, int n) {
+  unsigned int h = cast(unsigned int, n);
+  while (n--) {
+    h ^= point2uint(fr[n].f) + cast(unsigned int, fr[n].pc);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+
+static int sameframes (const ProfFrame *a, const ProfFrame *b, int n) {
+  while (n--) {
+    if (a[n].f != b[n].f || a[n].pc != b[n].pc)
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Collect in 'fr' the (at most 'max') innermost frames of the stack of
+** 'L'; returns their number
+*/
+static int getframes (lua_State *L, int lines, ProfFrame *fr, int max) {
+  CallInfo *ci;
+  int n = 0;
+  for (ci = L->ci; ci != &L->base_ci && n < max; ci = ci->previous) {
+    if (isLua(ci)) {
+      Proto *p = clLvalue(ci->func)->p;
+      int pc = pcRel(ci->u.l.savedpc, p);
+      fr[n].f = p;
+      fr[n].pc = (lines && pc > 0) ? pc : 0;
+    }
+    else {
+      lua_CFunction f = ttislcf(ci->func) ? fvalue(ci->func)
+                                          : clCvalue(ci->func)->f;
+      fr[n].f = cast(void *, cast(size_t, f));
+      fr[n].pc = -1;
+    }
+    n++;
+  }
+  return n;
+}
+
+
+/*
+** Find the entry for the stack 'fr' (with 'n' frames) in the profile,
+** adding it if needed. Returns NULL if there is no space for it.
+*/
+static ProfStack *findstack (Profile *pf, const ProfFrame *fr, int n) {
+  unsigned int h = hashframes(fr, n);
+  int i;
+  for (i = lmod(h, pf->sizestacks); ; i = lmod(i + 1, pf->sizestacks)) {
+    ProfStack *s = &pf->stacks[i];
+    if (s->count == 0) {  /* new stack */
+      if (pf->nstacks >= pf->maxstacks ||
+          pf->nframes + n > pf->sizeframes)  /* no space? */
+        return NULL;
+      s->hash = h;
+      s->first = pf->nframes;
+      s->depth = n;
+      memcpy(pf->frames + pf->nframes, fr, n * sizeof(ProfFrame));
+      pf->nframes += n;
+      pf->nstacks++;
+      return s;
+    }
+    else if (s->hash == h && s->depth == n &&
+             sameframes(pf->frames + s->first, fr, n))
+      return s;
+  }
+}
+
+
+void luaR_sample (lua_State *L) {
+  Profile *pf = G(L)->profile;
+  ProfFrame fr[LUAI_PROFDEPTH];
+  ProfStack *s;
+  L->hookmask &= ~PROFMASK;
+  if (pf == NULL || pf->sizestacks == 0)
+    return;  /* not profiling */
+  s = findstack(pf, fr, getframes(L, pf->lines, fr, LUAI_PROFDEPTH));
+  if (s != NULL)
+    s->count++;
+  else
+    pf->dropped++;
+}
+
+
+void luaR_free (lua_State *L, Profile *pf) {
+  global_State *g = G(L);
+  if (pf->objs != NULL)  /* see 'resizeobjs' */
+    (*g->frealloc)(g->ud, pf->objs, pf->sizeobjs * sizeof(HeapObj), 0);
+  luaM_freearray(L, pf->stacks, pf->sizestacks);
+  luaM_freearray(L, pf->frames, pf->sizeframes);
+  luaM_free(L, pf);
+}
+
+
+/*
+** Create a profile with room for 'size' distinct stacks (a default size
+** if 'size' <= 0), freeing the one at '*ppf' if there is one. The new
+** profile is anchored at '*ppf' before its parts are allocated.
+*/
+static Profile *newprofile (lua_State *L, Profile **ppf, int size) {
+  Profile *pf;
+  int sizestacks, sizeframes;
+  if (size <= 0) size = LUAI_PROFSTACKS;
+  else if (size > MAXPROFSTACKS) size = MAXPROFSTACKS;
+  sizestacks = 1 << luaO_ceillog2(cast(unsigned int, 2 * size));
+  sizeframes = size * (LUAI_PROFDEPTH / 4);  /* room for average depth */
+  if (*ppf != NULL) {
+    luaR_free(L, *ppf);
+    *ppf = NULL;
+  }
+  pf = luaM_new(L, Profile);
+  memset(pf, 0, sizeof(Profile));
+  *ppf = pf;
+  pf->stacks = luaM_newvector(L, sizestacks, ProfStack);
+  memset(pf->stacks, 0, sizestacks * sizeof(ProfStack));
+  pf->sizestacks = sizestacks;
+  pf->frames = luaM_newvector(L, sizeframes, ProfFrame);
+  pf->sizeframes = sizeframes;
+  pf->maxstacks = size;
+  return pf;
+}
+
+
+/*
+** Start (or restart) profiling, keeping at most 'size' distinct stacks
+** (a default size if 'size' <= 0). If 'lines', samples distinguish the
+** current lines of Lua functions, not only the functions.
+*/
+LUA_API void lua_profstart (lua_State *L, int size, int lines) {
+  lua_lock(L);
+  newprofile(L, &G(L)->profile, size)->lines = lines;
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_profstop (lua_State *L) {
+  global_State *g = G(L);
+  lua_lock(L);
+  if (g->profile != NULL) {
+    luaR_free(L, g->profile);
+    g->profile = NULL;
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Request a sample of the stack of the thread running in the state of
+** 'L'. Like 'lua_sethook', it can be called asynchronously (from a
+** signal handler or another thread); a request that races with a
+** change in the hook mask may be lost.
+*/
+LUA_API void lua_profsample (lua_State *L) {
+  lua_State *L1 = G(L)->running;
+  L1->hookmask |= PROFMASK;
+}
+
+
+static int writeframe (lua_State *L, const ProfFrame *fr, int lines,
+                       lua_Writer writer, void *data) {
+  char buff[LUA_IDSIZE + 40];
+  size_t len;
+  if (fr->f == NULL)  /* type of an allocated object? */
+    l_sprintf(buff, sizeof(buff), "[%s]", ttypename(fr->pc));
+  else if (fr->pc >= 0) {
+    Proto *p = cast(Proto *, fr->f);
+    int line = lines ? luaG_getfuncline(p, fr->pc) : p->linedefined;
+    if (p->source)
+      luaO_chunkid(buff, getstr(p->source), LUA_IDSIZE);
+    else
+      strcpy(buff, "?");
+    len = strlen(buff);
+    l_sprintf(buff + len, sizeof(buff) - len, ":%d", line);
+  }
+  else {
+    strcpy(buff, "[C]:");
+    lua_pointer2str(buff + 4, sizeof(buff) - 4, fr->f);
+  }
+  return writer(L, buff, strlen(buff), data);
+}
+
+
+static int writecount (lua_State *L, size_t count, lua_Writer writer,
+                       void *data) {
+  char buff[LUAI_MAXSHORTLEN];
+  l_sprintf(buff, sizeof(buff), " " LUA_INTEGER_FMT "\n",
+            cast(LUAI_UACINT, count));
+  return writer(L, buff, strlen(buff), data);
+}
+
+
+/* what 'dumpprofile' writes for each stack */
+#define DUMPCOUNT	0  /* number of samples */
+#define DUMPLIVE	1  /* bytes still alive */
+#define DUMPTOTAL	2  /* all bytes allocated */
+
+
+static int dumpprofile (lua_State *L, Profile *pf, int what,
+                        lua_Writer writer, void *data) {
+  int status = 0;
+  int i, j;
+  for (i = 0; pf != NULL && i < pf->sizestacks && status == 0; i++) {
+    ProfStack *s = &pf->stacks[i];
+    size_t v = (what == DUMPCOUNT) ? s->count
+             : (what == DUMPLIVE) ? s->live : s->total;
+    if (v == 0) continue;
+    for (j = s->depth - 1; j >= 0 && status == 0; j--) {
+      status = writeframe(L, pf->frames + s->first + j, pf->lines,
+                          writer, data);
+      if (j > 0 && status == 0)
+        status = writer(L, ";", 1, data);
+    }
+    if (status == 0)
+      status = writecount(L, v, writer, data);
+  }
+  if (pf != NULL && pf->dropped > 0 && what != DUMPLIVE && status == 0) {
+    status = writer(L, "[dropped]", 9, data);
+    if (status == 0)
+      status = writecount(L, pf->dropped, writer, data);
+  }
+  return status;
+}
+
+
+/*
+** Write the profile in the 'folded stacks' format used by flame-graph
+** tools: a line per distinct stack, with its frames from the outermost
+** one separated by ';' and then its number of samples. A Lua frame is
+** its source plus the line where its function was defined or (see
+** 'lua_profstart') its current line. Samples dropped for lack of space
+** appear as a stack "[dropped]". Returns the first non-zero result
+** from the writer, or 0.
+*/
+LUA_API int lua_profdump (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  lua_lock(L);
+  status = dumpprofile(L, G(L)->profile, DUMPCOUNT, writer, data);
+  lua_unlock(L);
+  return status;
+}
+
+
+
+/*
+** {======================================================
+** Heap profiler
+** =======================================================
+*/
+
+/*
+** Roughly every 'interval' bytes given to new collectable objects,
+** 'luaC_newobj' (or 'lua_newthread', which also reuses pooled threads)
+** calls 'luaR_heapsample', which records the call stack (with current
+** lines) and the type of the new object, and charges the stack with
+** the bytes allocated since the previous sample. Sampled
+** objects get the bit SAMPLEDBIT and are kept in a hash table (keyed
+** by address) with their stacks and weights, so that 'freeobj' can
+** discount them from the live bytes of their stacks. That table is
+** allocated directly through the allocation function, so that it does
+** not change the collector debt (and so the behavior of the program).
+*/
+
+static int hashobj (const Profile *pf, const GCObject *o) {
+  return lmod(point2uint(o) * 2654435761u, pf->sizeobjs);
+}
+
+
+static int insertobj (Profile *pf, GCObject *o, int stack, size_t w) {
+  int i = hashobj(pf, o);
+  while (pf->objs[i].o != NULL)
+    i = lmod(i + 1, pf->sizeobjs);
+  pf->objs[i].o = o;
+  pf->objs[i].stack = stack;
+  pf->objs[i].weight = w;
+  return i;
+}
+
+
+/* resize the table of objects to 'size' entries; returns 0 on failure */
+static int resizeobjs (global_State *g, Profile *pf, int size) {
+  HeapObj *old = pf->objs;
+  int oldsize = pf->sizeobjs;
+  int i;
+  HeapObj *objs = cast(HeapObj *, (*g->frealloc)(g->ud, NULL, 0,
+                                   size * sizeof(HeapObj)));
+  if (objs == NULL)
+    return 0;
+  memset(objs, 0, size * sizeof(HeapObj));
+  pf->objs = objs;
+  pf->sizeobjs = size;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].o != NULL)
+      insertobj(pf, old[i].o, old[i].stack, old[i].weight);
+  }
+  if (old != NULL)
+    (*g->frealloc)(g->ud, old, oldsize * sizeof(HeapObj), 0);
+  return 1;
+}
+
+
+void luaR_heapsample (lua_State *L, GCObject *o, size_t sz) {
+  global_State *g = G(L);
+  Profile *pf = g->heapprof;
+  ProfFrame fr[LUAI_PROFDEPTH];
+  ProfStack *s;
+  size_t w;
+  pf->countdown -= cast(l_mem, sz);
+  if (pf->countdown > 0)
+    return;  /* no sample yet */
+  /* charge all the bytes since the previous sample */
+  w = cast(size_t, pf->interval) *
+      (1 + cast(size_t, -pf->countdown / pf->interval));
+  pf->countdown += cast(l_mem, w);
+  if (2 * (pf->nobjs + 1) > pf->sizeobjs &&
+      !resizeobjs(g, pf, pf->sizeobjs > 0 ? 2 * pf->sizeobjs : 64)) {
+    pf->dropped += w;  /* cannot keep it */
+    return;
+  }
+  fr[0].f = NULL;  /* innermost frame is the type of the object */
+  fr[0].pc = novariant(o->tt);
+  s = findstack(pf, fr, 1 + getframes(L, 1, fr + 1, LUAI_PROFDEPTH - 1));
+  if (s == NULL) {
+    pf->dropped += w;
+    return;
+  }
+  s->count++;
+  s->total += w;
+  s->live += w;
+  insertobj(pf, o, cast_int(s - pf->stacks), w);
+  pf->nobjs++;
+  l_setbit(o->marked, SAMPLEDBIT);
+}
+
+
+/*
+** A sampled object is being freed: discount it from its stack and
+** remove it from the table, moving back entries of its probe sequence
+** that would not be found with it gone.
+*/
+void luaR_heapfree (lua_State *L, GCObject *o) {
+  Profile *pf = G(L)->heapprof;
+  int i, j;
+  resetbit(o->marked, SAMPLEDBIT);
+  if (pf == NULL || pf->sizeobjs == 0)
+    return;  /* object from a previous profile */
+  for (i = hashobj(pf, o); pf->objs[i].o != o;
+       i = lmod(i + 1, pf->sizeobjs)) {
+    if (pf->objs[i].o == NULL)
+      return;  /* object from a previous profile */
+  }
+  pf->stacks[pf->objs[i].stack].live -= pf->objs[i].weight;
+  pf->nobjs--;
+  for (j = lmod(i + 1, pf->sizeobjs); pf->objs[j].o != NULL;
+       j = lmod(j + 1, pf->sizeobjs)) {
+    int h = hashobj(pf, pf->objs[j].o);
+    /* can entry 'j' move to the hole at 'i'? (is 'h' out of (i,j]?) */
+    if ((i < j) ? (h <= i || h > j) : (h <= i && h > j)) {
+      pf->objs[i] = pf->objs[j];
+      i = j;
+    }
+  }
+  pf->objs[i].o = NULL;
+}
+
+
+/*
+** Start (or restart) heap profiling, sampling about once every
+** 'interval' allocated bytes (a default interval if 'interval' <= 0)
+** and keeping at most 'size' distinct stacks (a default size if
+** 'size' <= 0).
+*/
+LUA_API void lua_heapprofstart (lua_State *L, int interval, int size) {
+  Profile *pf;
+  lua_lock(L);
+  pf = newprofile(L, &G(L)->heapprof, size);
+  pf->lines = 1;
+  pf->interval = (interval > 0) ? interval : LUAI_HEAPINTERVAL;
+  pf->countdown = pf->interval;
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_heapprofstop (lua_State *L) {
+  global_State *g = G(L);
+  lua_lock(L);
+  if (g->heapprof != NULL) {
+    luaR_free(L, g->heapprof);
+    g->heapprof = NULL;
+  }
+  lua_unlock(L);
+}
+
+
+/*
+** Write the heap profile as folded stacks (see 'lua_profdump'), with
+** the type of the allocated objects as their innermost frames, e.g.
+** "[table]". The value of each stack is its estimated number of bytes
+** still alive, if 'live', or else allocated since profiling started.
+*/
+LUA_API int lua_heapprofdump (lua_State *L, lua_Writer writer, void *data,
+                              int live) {
+  int status;
+  lua_lock(L);
+  status = dumpprofile(L, G(L)->heapprof, live ? DUMPLIVE : DUMPTOTAL,
+                       writer, data);
+  lua_unlock(L);
+  return status;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Heap snapshot
+** =======================================================
+*/
+
+/*
+** A snapshot is text, with a line per item:
+**   "r <id>": a root of the object graph;
+**   "o <id> <type> <size> <ref>...": an object, with its size in bytes
+**     and the objects it refers to ("~<id>" for weak references);
+**   "n <id> <text>": a description of an object (the contents of a
+**     string, where a function was defined, etc.).
+** Ids are addresses, which are unique while the snapshot is written.
+*/
+
+/* maximum length of the description of an object */
+#define MAXSNAPLABEL	60
+
+
+typedef struct SnapState {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  int status;
+  size_t n;  /* number of bytes in 'buff' */
+  char buff[1024];
+} SnapState;
+
+
+static void snapflush (SnapState *S) {
+  if (S->n > 0 && S->status == 0)
+    S->status = (*S->writer)(S->L, S->buff, S->n, S->data);
+  S->n = 0;
+}
+
+
+static void snapadd (SnapState *S, const char *s, size_t l) {
+  if (S->n + l > sizeof(S->buff))
+    snapflush(S);
+  lua_assert(l <= sizeof(S->buff));
+  memcpy(S->buff + S->n, s, l);
+  S->n += l;
+}
+
+
+static void snapstr (SnapState *S, const char *s) {
+  snapadd(S, s, strlen(s));
+}
+
+
+/* add 'prefix' followed by the id of 'p' */
+static void snapid (SnapState *S, const char *prefix, const void *p) {
+  char buff[LUAI_MAXSHORTLEN];
+  snapstr(S, prefix);
+  lua_pointer2str(buff, sizeof(buff), p);
+  snapstr(S, buff);
+}
+
+
+static void snapref (SnapState *S, const void *p) {
+  if (p != NULL)
+    snapid(S, " ", p);
+}
+
+
+static void snapvalue (SnapState *S, const TValue *o, int weak) {
+  if (iscollectable(o))
+    snapid(S, weak ? " ~" : " ", gcvalue(o));
+}
+
+
+static void snaplabel (SnapState *S, const void *p, const char *s,
+                       size_t l) {
+  char buff[MAXSNAPLABEL + 4];
+  size_t i, n = 0;
+  for (i = 0; i < l && n < MAXSNAPLABEL; i++) {
+    unsigned char c = cast(unsigned char, s[i]);
+    buff[n++] = (c < ' ' || c == 127) ? '.' : cast(char, c);
+  }
+  if (i < l) {  /* truncated? */
+    memcpy(buff + n, "...", 3);
+    n += 3;
+  }
+  snapid(S, "n ", p);
+  snapadd(S, " ", 1);
+  snapadd(S, buff, n);
+  snapadd(S, "\n", 1);
+}
+
+
+static void snapproto (SnapState *S, const void *o, Proto *p) {
+  char buff[LUA_IDSIZE + 40];
+  size_t len;
+  if (p->source)
+    luaO_chunkid(buff, getstr(p->source), LUA_IDSIZE);
+  else
+    strcpy(buff, "?");
+  len = strlen(buff);
+  l_sprintf(buff + len, sizeof(buff) - len, ":%d", p->linedefined);
+  snaplabel(S, o, buff, strlen(buff));
+}
+
+
+static void snaphead (SnapState *S, const GCObject *o, size_t size) {
+  char buff[LUAI_MAXSHORTLEN];
+  snapid(S, "o ", o);
+  snapadd(S, " ", 1);
+  snapstr(S, ttypename(novariant(o->tt)));
+  l_sprintf(buff, sizeof(buff), " " LUA_INTEGER_FMT,
+            cast(LUAI_UACINT, size));
+  snapstr(S, buff);
+}
+
+
+static void snaptable (SnapState *S, Table *h) {
+  const TValue *mode = gfasttm(G(S->L), h->metatable, TM_MODE);
+  int wkey = 0, wvalue = 0;
+  unsigned int i;
+  Node *n, *limit = gnode(h, cast(size_t, sizenode(h)));
+  if (mode && ttisstring(mode)) {
+    wkey = (strchr(svalue(mode), 'k') != NULL);
+    wvalue = (strchr(svalue(mode), 'v') != NULL);
+  }
+  snaphead(S, obj2gco(h), sizeof(Table) + sizeof(TValue) * h->sizearray +
+                          sizeof(Node) * allocsizenode(h));
+  snapref(S, h->metatable);
+  for (i = 0; i < h->sizearray; i++)
+    snapvalue(S, &h->array[i], wvalue);
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (!ttisnil(gval(n))) {
+      snapvalue(S, gkey(n), wkey);
+      snapvalue(S, gval(n), wvalue);
+    }
+  }
+}
+
+
+static void snapobject (SnapState *S, GCObject *o) {
+  int i;
+  switch (o->tt) {
+    case LUA_TSHRSTR: case LUA_TLNGSTR: {
+      TString *ts = gco2ts(o);
+      snaphead(S, o, sizelstring(tsslen(ts)));
+      snapadd(S, "\n", 1);
+      snaplabel(S, o, getstr(ts), tsslen(ts));
+      return;
+    }
+    case LUA_TTABLE: {
+      snaptable(S, gco2t(o));
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = gco2u(o);
+      TValue uv;
+      snaphead(S, o, sizeudata(u));
+      snapref(S, u->metatable);
+      getuservalue(S->L, u, &uv);
+      snapvalue(S, &uv, 0);
+      break;
+    }
+    case LUA_TLCL: {
+      LClosure *cl = gco2lcl(o);
+      snaphead(S, o, sizeLclosure(cl->nupvalues));
+      snapref(S, cl->p);
+      for (i = 0; i < cl->nupvalues; i++) {
+        if (cl->upvals[i] != NULL)
+          snapvalue(S, cl->upvals[i]->v, 0);
+      }
+      snapadd(S, "\n", 1);
+      snapproto(S, o, cl->p);
+      return;
+    }
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      char buff[LUAI_MAXSHORTLEN];
+      snaphead(S, o, sizeCclosure(cl->nupvalues));
+      for (i = 0; i < cl->nupvalues; i++)
+        snapvalue(S, &cl->upvalue[i], 0);
+      snapadd(S, "\n", 1);
+      strcpy(buff, "[C]:");
+      lua_pointer2str(buff + 4, sizeof(buff) - 4,
+                      cast(void *, cast(size_t, cl->f)));
+      snaplabel(S, o, buff, strlen(buff));
+      return;
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      StkId v;
+      snaphead(S, o, sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+                     sizeof(CallInfo) * th->nci);
+      for (v = th->stack; v != NULL && v < th->top; v++)
+        snapvalue(S, v, 0);
+      break;
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      snaphead(S, o, sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                     sizeof(Proto *) * f->sizep +
+                     sizeof(TValue) * f->sizek +
+                     sizeof(ls_byte) * f->sizelineinfo +
+                     sizeof(AbsLineInfo) * f->sizeabslineinfo +
+                     sizeof(LocVar) * f->sizelocvars +
+                     sizeof(Upvaldesc) * f->sizeupvalues);
+      snapref(S, f->source);
+      for (i = 0; i < f->sizek; i++)
+        snapvalue(S, &f->k[i], 0);
+      for (i = 0; i < f->sizeupvalues; i++)
+        snapref(S, f->upvalues[i].name);
+      for (i = 0; i < f->sizep; i++)
+        snapref(S, f->p[i]);
+      for (i = 0; i < f->sizelocvars; i++)
+        snapref(S, f->locvars[i].varname);
+      if (f->cache != NULL)
+        snapid(S, " ~", f->cache);
+      snapadd(S, "\n", 1);
+      snapproto(S, o, f);
+      return;
+    }
+    default: lua_assert(0);
+  }
+  snapadd(S, "\n", 1);
+}
+
+
+static void snaplist (SnapState *S, GCObject *o, int roots) {
+  for (; o != NULL && S->status == 0; o = o->next) {
+    if (roots) {
+      snapid(S, "r ", o);
+      snapadd(S, "\n", 1);
+    }
+    else
+      snapobject(S, o);
+  }
+}
+
+
+/*
+** Write a snapshot of all objects in the state after a full
+** collection (so that all of them are alive). The collector is stopped
+** while the snapshot is written, so the writer may allocate memory but
+** should not run Lua code. Returns the first non-zero result from the
+** writer, or 0.
+*/
+LUA_API int lua_heapsnapshot (lua_State *L, lua_Writer writer, void *data) {
+  global_State *g = G(L);
+  SnapState S;
+  const TValue *globals;
+  lu_byte oldrunning;
+  int i;
+  lua_lock(L);
+  luaC_fullgc(L, 0);
+  oldrunning = g->gcrunning;
+  g->gcrunning = 0;  /* keep all objects in place */
+  S.L = L; S.writer = writer; S.data = data;
+  S.status = 0; S.n = 0;
+  snapstr(&S, "lua-heapsnapshot 1\n");
+  snapid(&S, "r ", gcvalue(&g->l_registry));
+  snapid(&S, "\nr ", g->mainthread);
+  if (L != g->mainthread) snapid(&S, "\nr ", L);
+  snapadd(&S, "\n", 1);
+  for (i = 0; i < LUA_NUMTAGS; i++) {
+    if (g->mt[i] != NULL) {
+      snapid(&S, "r ", g->mt[i]);
+      snapadd(&S, "\n", 1);
+    }
+  }
+  snaplist(&S, g->fixedgc, 1);  /* never collected */
+  snaplist(&S, g->tobefnz, 1);  /* waiting for their finalizers */
+  snaplabel(&S, gcvalue(&g->l_registry), "registry", 8);
+  snaplabel(&S, g->mainthread, "main thread", 11);
+  globals = luaH_getint(hvalue(&g->l_registry), LUA_RIDX_GLOBALS);
+  if (ttistable(globals))
+    snaplabel(&S, hvalue(globals), "_G", 2);
+  snapobject(&S, obj2gco(g->mainthread));
+  snaplist(&S, g->allgc, 0);
+  snaplist(&S, g->finobj, 0);
+  snaplist(&S, g->tobefnz, 0);
+  snaplist(&S, g->fixedgc, 0);
+  snapflush(&S);
+  g->gcrunning = oldrunning;
+  lua_unlock(L);
+  return S.status;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Opcode statistics
+** =======================================================
+*/
+
+#if defined(LUAI_OPSTATS)
+
+void luaR_newhits (lua_State *L, Proto *p) {
+  lu_mem *hits = luaM_newvector(L, p->sizecode, lu_mem);
+  memset(hits, 0, p->sizecode * sizeof(lu_mem));
+  p->hits = hits;
+}
+
+
+void luaR_resetopstats (global_State *g) {
+  memset(g->opcount, 0, sizeof(g->opcount));
+  memset(g->oppairs, 0, sizeof(g->oppairs));
+  g->lastop = 0;
+}
+
+
+/* set t[name] = count */
+static void setcount (lua_State *L, Table *t, const char *name, lu_mem n) {
+  TValue k;
+  setsvalue(L, &k, luaS_new(L, name));
+  setivalue(luaH_set(L, t, &k), l_castU2S(n));
+}
+
+
+static void pushcounts (lua_State *L, int pairs) {
+  global_State *g = G(L);
+  Table *t = luaH_new(L);
+  int o, o2;
+  sethvalue(L, L->top, t);
+  api_incr_top(L);
+  for (o = 0; o < NUM_OPCODES; o++) {
+    if (!pairs)
+      setcount(L, t, luaP_opnames[o], g->opcount[o]);
+    else {
+      for (o2 = 0; o2 < NUM_OPCODES; o2++) {
+        if (g->oppairs[o][o2] > 0) {
+          char buff[2 * 16];
+          l_sprintf(buff, sizeof(buff), "%s ", luaP_opnames[o]);
+          strcat(buff, luaP_opnames[o2]);
+          setcount(L, t, buff, g->oppairs[o][o2]);
+        }
+      }
+    }
+  }
+}
+
+#endif
+
+
+/*
+** Get opcode statistics, pushing a table for each option in 'what':
+** 'c' maps opcode names to their numbers of executions, 'p' maps
+** pairs "OP1 OP2" to the number of times OP2 ran right after OP1; 'r'
+** resets all counts. Returns the number of tables pushed, or -1 if
+** Lua was not built with LUAI_OPSTATS.
+*/
+LUA_API int lua_getopstats (lua_State *L, const char *what) {
+#if defined(LUAI_OPSTATS)
+  int n = 0;
+  lua_lock(L);
+  for (; *what; what++) {
+    switch (*what) {
+      case 'c': pushcounts(L, 0); n++; break;
+      case 'p': pushcounts(L, 1); n++; break;
+      case 'r': luaR_resetopstats(G(L)); break;
+      default: break;  /* invalid option */
+    }
+  }
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return n;
+#else
+  UNUSED(L); UNUSED(what);
+  return -1;
+#endif
+}
+
+/* }====================================================== */
@@ -0,0 +1,95 @@
+/*
+** $Id: lprof.h $
+** Profilers and heap snapshots
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lprof_h
+#define lprof_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/* maximum number of frames kept for each sample (the innermost ones) */
+#if !defined(LUAI_PROFDEPTH)
+#define LUAI_PROFDEPTH	64
+#endif
+
+
+/* default maximum number of distinct stacks in a profile */
+#define LUAI_PROFSTACKS	4096
+
+
+/* default number of allocated bytes between heap samples */
+#define LUAI_HEAPINTERVAL	(32 * 1024)
+
+
+/*
+** A frame of a sampled stack: a Lua function with the instruction it
+** was running, or a C function ('pc' == -1). In heap profiles, the
+** innermost frame is the type of the allocated object ('f' == NULL,
+** 'pc' is the type tag).
+*/
+typedef struct ProfFrame {
+  void *f;  /* 'Proto *', C function, or NULL */
+  int pc;
+} ProfFrame;
+
+
+/* a distinct stack with its number of samples */
+typedef struct ProfStack {
+  unsigned int hash;
+  unsigned int count;  /* 0 for a free slot */
+  int first;  /* index in 'frames' of its innermost frame */
+  int depth;
+  size_t live;  /* (heap profiles) bytes sampled still alive */
+  size_t total;  /* (heap profiles) all bytes sampled */
+} ProfStack;
+
+
+/* a sampled object still alive, with the bytes it stands for */
+typedef struct HeapObj {
+  GCObject *o;  /* NULL for a free slot */
+  int stack;  /* index in 'stacks' of its allocation stack */
+  size_t weight;
+} HeapObj;
+
+
+/*
+** Samples are aggregated into a hash table of stacks, preallocated
+** when profiling starts; once it is full, samples of new stacks are
+** only counted as dropped.
+*/
+typedef struct Profile {
+  ProfStack *stacks;
+  ProfFrame *frames;
+  int sizestacks;  /* size of 'stacks' (a power of 2) */
+  int maxstacks;  /* maximum number of stacks in use */
+  int nstacks;  /* number of stacks in use */
+  int sizeframes;
+  int nframes;
+  int lines;  /* keep current lines (instead of only functions)? */
+  size_t dropped;  /* number of samples (bytes, in heaps) without space */
+  l_mem interval;  /* (heap profiles) bytes between samples */
+  l_mem countdown;  /* bytes to allocate before next sample */
+  HeapObj *objs;  /* hash table of sampled objects */
+  int sizeobjs;  /* size of 'objs' (0 or a power of 2) */
+  int nobjs;
+} Profile;
+
+
+/* take a sample if one was requested (see 'lua_profsample') */
+#define luaR_checksample(L)  \
+	{ if ((L)->hookmask & PROFMASK) luaR_sample(L); }
+
+LUAI_FUNC void luaR_sample (lua_State *L);
+LUAI_FUNC void luaR_free (lua_State *L, Profile *pf);
+LUAI_FUNC void luaR_heapsample (lua_State *L, GCObject *o, size_t sz);
+LUAI_FUNC void luaR_heapfree (lua_State *L, GCObject *o);
+#if defined(LUAI_OPSTATS)
+LUAI_FUNC void luaR_newhits (lua_State *L, Proto *p);
+LUAI_FUNC void luaR_resetopstats (global_State *g);
+#endif
+
+#endif
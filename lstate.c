@@ -23,6 +23,7 @@
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -37,6 +38,11 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+/* maximum number of dead threads kept for reuse by 'lua_newthread' */
+#if !defined(LUAI_MAXTHREADPOOL)
+#define LUAI_MAXTHREADPOOL	32
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -152,20 +158,17 @@ void luaE_shrinkCI (lua_State *L) {
 /*
 ** 初始化栈(分为数据栈和调用栈)
 */
-static void stack_init (lua_State *L1, lua_State *L) {
+static void stack_reset (lua_State *L1) {
   int i; CallInfo *ci;
-  /* initialize stack array - 默认分配一个大小为40的栈 */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE, TValue);
-  L1->stacksize = BASIC_STACK_SIZE;
-  for (i = 0; i < BASIC_STACK_SIZE; i++)
-    setnilvalue(L1->stack + i);  /* erase new stack */
+  for (i = 0; i < L1->stacksize; i++)
+    setnilvalue(L1->stack + i);  /* erase stack */
   L1->top = L1->stack;
   /* 留空EXTRA_STACK=5个作为空闲buf,用于元表调用或错误处理的栈操作,
      也就是说这些空闲buf可以让某些操作不用考虑栈空间是否足够 */
   L1->stack_last = L1->stack + L1->stacksize - EXTRA_STACK;
-  /* initialize first ci */
+  /* initialize first ci (keeping the list of free ones) */
   ci = &L1->base_ci;
-  ci->next = ci->previous = NULL;
+  ci->previous = NULL;
   ci->callstatus = 0;
   ci->func = L1->top;  /* 指向当前栈顶 */
   setnilvalue(L1->top++);  /* 'function' entry for this 'ci' */
@@ -174,6 +177,15 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+static void stack_init (lua_State *L1, lua_State *L) {
+  /* initialize stack array - 默认分配一个大小为40的栈 */
+  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE, TValue);
+  L1->stacksize = BASIC_STACK_SIZE;
+  L1->base_ci.next = NULL;
+  stack_reset(L1);
+}
+
+
 /*
 ** 释放栈结构内存
 */
@@ -237,12 +249,7 @@ static void f_luaopen (lua_State *L, void *ud) {
 ** preinitialize a thread with consistent values without allocating
 ** any memory (to avoid errors)
 */
-static void preinit_thread (lua_State *L, global_State *g) {
-  G(L) = g;
-  L->stack = NULL;
-  L->ci = NULL;
-  L->nci = 0;
-  L->stacksize = 0;
+static void resetthread (lua_State *L) {
   L->twups = L;  /* thread has no upvalues */
   L->errorJmp = NULL;
   L->nCcalls = 0;
@@ -258,6 +265,16 @@ static void preinit_thread (lua_State *L, global_State *g) {
 }
 
 
+static void preinit_thread (lua_State *L, global_State *g) {
+  G(L) = g;
+  L->stack = NULL;
+  L->ci = NULL;
+  L->nci = 0;
+  L->stacksize = 0;
+  resetthread(L);
+}
+
+
 /*
 ** 释放Lua栈结构
 */
@@ -265,6 +282,16 @@ static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
   luaC_freeallobjects(L);  /* collect all objects - 释放全部对象 */
+  if (g->profile != NULL)
+    luaR_free(L, g->profile);
+  if (g->heapprof != NULL)
+    luaR_free(L, g->heapprof);
+  while (g->threadpool != NULL) {  /* free pooled threads */
+    lua_State *L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
@@ -284,18 +311,28 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   lua_State *L1;
   lua_lock(L);
   luaC_checkGC(L);
-  /* create new thread */
-  L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+  if (g->threadpool != NULL) {  /* reuse a dead thread (see below) */
+    L1 = gco2th(g->threadpool);
+    g->threadpool = L1->next;
+    g->nthreadpool--;
+    resetthread(L1);
+    stack_reset(L1);
+  }
+  else {  /* create new thread */
+    L1 = &cast(LX *, luaM_newobject(L, LUA_TTHREAD, sizeof(LX)))->l;
+    preinit_thread(L1, g);
+  }
   L1->marked = luaC_white(g);
   L1->tt = LUA_TTHREAD;
   /* link it on list 'allgc' */
   L1->next = g->allgc;
   g->allgc = obj2gco(L1);
+  if (g->heapprof != NULL)  /* not created by 'luaC_newobj' */
+    luaR_heapsample(L, obj2gco(L1), sizeof(LX));
   /* anchor it on L stack */
   setthvalue(L, L->top, L1);  /* 在栈顶上设置一个新的L1对象 */
   api_incr_top(L);
-  preinit_thread(L1, g);
-  L1->hookmask = L->hookmask;
+  L1->hookmask = L->hookmask & ~PROFMASK;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
   resethookcount(L1);
@@ -303,19 +340,40 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (L1->stack == NULL)
+    stack_init(L1, L);  /* init stack */
   lua_unlock(L);
   return L1;
 }
 
 
+/*
+** A dead thread goes to the pool of 'lua_newthread' (with its stack
+** and CallInfo list cut back to their initial sizes) while the pool
+** is not full.
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
   LX *l = fromstate(L1);
   luaF_close(L1, L1->stack);  /* close all upvalues for this thread */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
-  freestack(L1);
-  luaM_free(L, l);
+  if (g->nthreadpool < LUAI_MAXTHREADPOOL && L1->stack != NULL) {
+    L1->ci = &L1->base_ci;
+    luaE_freeCI(L1);
+    if (L1->stacksize > BASIC_STACK_SIZE) {  /* (shrinking cannot fail) */
+      luaM_reallocvector(L, L1->stack, L1->stacksize, BASIC_STACK_SIZE,
+                         TValue);
+      L1->stacksize = BASIC_STACK_SIZE;
+    }
+    L1->next = g->threadpool;
+    g->threadpool = obj2gco(L1);
+    g->nthreadpool++;
+  }
+  else {
+    freestack(L1);
+    luaM_free(L, l);
+  }
 }
 
 
@@ -348,7 +406,12 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->mainthread = L;
   g->seed = makeseed(L);
   g->gcrunning = 0;  /* no GC while building state */
+  g->optlevel = LUAI_OPTLEVEL;
+#if !defined(LUAI_NOGCACHE)
+  g->tabversion = 0;
+#endif
   g->GCestimate = 0;
+  g->GCsoftlimit = g->GChardlimit = MAX_LUMEM;  /* no limits */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
   setnilvalue(&g->l_registry);
@@ -361,6 +424,18 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
+  memset(&g->stackstats, 0, sizeof(g->stackstats));
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  g->gccallback = NULL;
+  g->gcud = NULL;
+  g->profile = NULL;
+  g->heapprof = NULL;
+  g->running = L;
+#if defined(LUAI_OPSTATS)
+  luaR_resetopstats(g);
+#endif
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->gcfinnum = 0;
@@ -10,6 +10,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "ltm.h"
 #include "lzio.h"
 
@@ -61,6 +62,16 @@ struct lua_longjmp;  /* defined in ldo.c */
 #endif
 
 
+/*
+** Bit in 'hookmask' set by 'lua_profsample' to request a profiler
+** sample. Like line and count hooks, it makes the interpreter call
+** 'luaG_traceexec' before the next instruction.
+*/
+#define PROFMASK	(1 << (LUA_HOOKTAILCALL + 1))
+
+#define TRACEMASK	(LUA_MASKLINE | LUA_MASKCOUNT | PROFMASK)
+
+
 /* extra stack space to handle TM calls and some other extras */
 #define EXTRA_STACK   5
 
@@ -161,6 +172,8 @@ typedef struct global_State {
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCmemtrav;  /* memory traversed by the GC */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
+  lu_mem GCsoftlimit;  /* above it, collect more aggressively */
+  lu_mem GChardlimit;  /* allocations beyond it fail */
   stringtable strt;  /* hash table for strings - 字符串表 Lua的字符串分短字符串和长字符串 */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes */
@@ -168,6 +181,7 @@ typedef struct global_State {
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte optlevel;  /* optimization level for new functions */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -179,6 +193,15 @@ typedef struct global_State {
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
   struct lua_State *twups;  /* list of threads with open upvalues - 闭包了当前线程变量的其他线程列表 */
+  GCObject *threadpool;  /* dead threads kept for reuse */
+  lua_StackStats stackstats;  /* stack reallocation counters */
+  lua_GCStats gcstats;  /* collector telemetry */
+  lua_GCCallback gccallback;  /* called when a GC cycle starts/ends */
+  void *gcud;  /* auxiliary data to 'gccallback' */
+  struct Profile *profile;  /* sampling profiler data (or NULL) */
+  struct Profile *heapprof;  /* heap profiler data (or NULL) */
+  struct lua_State *volatile running;  /* thread running (or resuming) */
+  int nthreadpool;  /* number of threads in 'threadpool' */
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
@@ -195,6 +218,14 @@ typedef struct global_State {
   ** 估计作者认为hash冲突的概率会非常小,同时每次都会将最早的元素淘汰出去
   */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API - 字符串缓存 */
+#if defined(LUAI_OPSTATS)
+  lu_mem opcount[NUM_OPCODES];  /* executions of each opcode */
+  lu_mem oppairs[NUM_OPCODES][NUM_OPCODES];  /* ... of each opcode pair */
+  int lastop;  /* opcode executed last */
+#endif
+#if !defined(LUAI_NOGCACHE)
+  lu_mem tabversion;  /* last version given to a table */
+#endif
   /*
   ** 版本号
   ** const lua_Number *version  版本号
@@ -81,6 +81,20 @@ static const Node dummynode_ = {
 };
 
 
+/*
+** Give table 't' a new version, invalidating the slots that global
+** caches keep for it. Versions come from a global counter, so that a
+** new table never gets the version of a dead one at the same address.
+** Needed whenever a key may be added or a node may move; plain
+** updates of existing entries keep their slots.
+*/
+#if !defined(LUAI_NOGCACHE)
+#define newversion(L,t)	((t)->version = ++G(L)->tabversion)
+#else
+#define newversion(L,t)	((void)0)
+#endif
+
+
 /*
 ** Hash for floating-point numbers.
 ** The main computation should be just
@@ -360,6 +374,7 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
   unsigned int oldasize = t->sizearray;
   int oldhsize = allocsizenode(t);
   Node *nold = t->node;  /* save old hash ... */
+  newversion(L, t);
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
@@ -445,6 +460,7 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  newversion(L, t);
   setnodevector(L, t, 0);  /* 设置节点空间 */
   return t;
 }
@@ -498,6 +514,7 @@ static Node *getfreepos (Table *t) {
 TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
   Node *mp;
   TValue aux;
+  newversion(L, t);
   if (ttisnil(key)) luaG_runerror(L, "table index is nil");  /* 检查key值是否是空值 */
   else if (ttisfloat(key)) {
     lua_Integer k;
@@ -117,6 +117,11 @@ typedef const char * (*lua_Reader) (lua_State *L, void *ud, size_t *sz);
 
 typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 
+/*
+** Type for functions that release the memory of a chunk image
+*/
+typedef void (*lua_Release) (void *ud, void *p, size_t sz);
+
 
 /*
 ** Type for memory-allocation functions
@@ -280,7 +285,15 @@ LUA_API int   (lua_pcallk) (lua_State *L, int nargs, int nresults, int errfunc,
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
 
+LUA_API int   (lua_loadimage) (lua_State *L, void *buff, size_t sz,
+                               const char *chunkname, const char *mode,
+                               lua_Release release, void *ud);
+
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
+LUA_API int (lua_dumpimage) (lua_State *L, lua_Writer writer, void *data,
+                             int strip);
+
+LUA_API int (lua_setoptlevel) (lua_State *L, int level);
 
 
 /*
@@ -308,10 +321,31 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
 #define LUA_GCISRUNNING		9
+#define LUA_GCSETSOFTLIMIT	10
+#define LUA_GCSETHARDLIMIT	11
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** garbage-collector telemetry
+*/
+#define LUA_GCNUMSTATES	8	/* number of states of the collector */
+#define LUA_GCHISTSIZE	16	/* buckets in the histogram of step times */
+
+/* events for the GC callback */
+#define LUA_GCEVSTART	0	/* a cycle started */
+#define LUA_GCEVEND	1	/* a cycle finished */
+
+typedef struct lua_GCStats lua_GCStats;
+
+typedef void (*lua_GCCallback) (lua_State *L, int event,
+                                const lua_GCStats *s, void *ud);
+
+LUA_API void (lua_getgcstats) (lua_State *L, lua_GCStats *s);
+LUA_API void (lua_setgccallback) (lua_State *L, lua_GCCallback f, void *ud);
+
+
 /*
 ** miscellaneous functions
 */
@@ -437,6 +471,23 @@ LUA_API lua_Hook (lua_gethook) (lua_State *L);
 LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+typedef struct lua_StackStats lua_StackStats;
+
+LUA_API void (lua_getstackstats) (lua_State *L, lua_StackStats *ss);
+
+LUA_API void (lua_profstart) (lua_State *L, int size, int lines);
+LUA_API void (lua_profstop) (lua_State *L);
+LUA_API void (lua_profsample) (lua_State *L);
+LUA_API int (lua_profdump) (lua_State *L, lua_Writer writer, void *data);
+
+LUA_API void (lua_heapprofstart) (lua_State *L, int interval, int size);
+LUA_API void (lua_heapprofstop) (lua_State *L);
+LUA_API int (lua_heapprofdump) (lua_State *L, lua_Writer writer, void *data,
+                                int live);
+LUA_API int (lua_heapsnapshot) (lua_State *L, lua_Writer writer, void *data);
+
+LUA_API int (lua_getopstats) (lua_State *L, const char *what);
+
 
 struct lua_Debug {
   int event;
@@ -456,6 +507,41 @@ struct lua_Debug {
   struct CallInfo *i_ci;  /* active function */
 };
 
+
+/* stack reallocations of all threads in a state */
+struct lua_StackStats {
+  size_t grows;		/* number of times a stack grew */
+  size_t shrinks;	/* number of times a stack shrank */
+  size_t moved;		/* stack slots copied by reallocations */
+  size_t fixups;	/* pointers corrected after reallocations */
+  int maxsize;		/* largest stack size reached (in slots) */
+};
+
+/*
+** Collector statistics since the state was created. States are, in
+** order: propagate, atomic, swpallgc, swpfinobj, swptobefnz, swpend,
+** callfin, and pause. Bucket 0 of 'steptimes' counts steps (including
+** full collections) shorter than 1 microsecond; bucket i counts steps
+** from 2^(i-1) up to 2^i microseconds, and the last bucket counts all
+** longer steps.
+*/
+struct lua_GCStats {
+  double time[LUA_GCNUMSTATES];	/* seconds spent in each state */
+  double lastatomic;	/* duration of the last atomic step (seconds) */
+  double maxatomic;	/* longest atomic step (seconds) */
+  size_t steptimes[LUA_GCHISTSIZE];	/* histogram of step durations */
+  size_t cycles;	/* number of completed cycles */
+  size_t steps;		/* number of steps and full collections */
+  size_t traversed;	/* bytes traversed by marking */
+  size_t swept;		/* bytes freed by sweeping */
+  size_t finalizers;	/* number of finalizers called */
+  /* current values */
+  size_t estimate;	/* estimate of non-garbage bytes */
+  size_t totalbytes;	/* bytes in use */
+  ptrdiff_t debt;	/* bytes allocated not yet paid by the collector */
+  int state;		/* current state */
+};
+
 /* }====================================================================== */
 
 
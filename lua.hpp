@@ -2,8 +2,17 @@
 // Lua header files for C++
 // <<extern "C">> not supplied automatically because Lua also compiles as C++
 
+// Define LUA_BUILD_AS_CPP when the Lua library itself is compiled as
+// C++ (so that Lua errors are C++ exceptions, which unwind host frames
+// properly); its API then has C++ linkage.
+#if defined(LUA_BUILD_AS_CPP)
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#else
 extern "C" {
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
 }
+#endif
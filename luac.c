@@ -17,6 +17,7 @@
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "lualib.h"
 
 #include "lobject.h"
 #include "lstate.h"
@@ -31,6 +32,9 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int imaging=0;			/* output a chunk image? */
+static int counting=0;			/* run and list execution counts? */
+static int optlevel=-1;			/* optimization level (-1: default) */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -56,8 +60,11 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -c       run chunks and list instruction counts (needs LUAI_OPSTATS)\n"
   "  -l       list (use -l -l for full listing)\n"
+  "  -m       output a chunk image (for lua_loadimage)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O[n]    optimize at level n (0 to 2; default 1)\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -86,8 +93,18 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-c"))			/* run and count */
+  {
+#if !defined(LUAI_OPSTATS)
+   usage("'-c' needs a build with LUAI_OPSTATS");
+#endif
+   counting=1;
+   if (!listing) listing=1;
+  }
   else if (IS("-l"))			/* list */
    ++listing;
+  else if (IS("-m"))			/* output a chunk image */
+   imaging=1;
   else if (IS("-o"))			/* output file */
   {
    output=argv[++i];
@@ -95,6 +112,13 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (argv[i][1]=='O')		/* optimize */
+  {
+   const char* s=argv[i]+2;
+   if (*s==0) optlevel=1;
+   else if ((*s=='0' || *s=='1' || *s=='2') && s[1]==0) optlevel=*s-'0';
+   else usage(argv[i]);
+  }
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -152,10 +176,18 @@ static const Proto* combine(lua_State* L, int n)
    if (f->p[i]->sizeupvalues>0) f->p[i]->upvalues[0].instack=0;
   }
   f->sizelineinfo=0;
+  f->sizeabslineinfo=0;
   return f;
  }
 }
 
+static void loaddebug(lua_State* L, Proto* f)	/* names left in images */
+{
+ int i;
+ luaU_needdebug(L,f);
+ for (i=0; i<f->sizep; i++) loaddebug(L,f->p[i]);
+}
+
 static int writer(lua_State* L, const void* p, size_t size, void* u)
 {
  UNUSED(L);
@@ -169,19 +201,33 @@ static int pmain(lua_State* L)
  const Proto* f;
  int i;
  if (!lua_checkstack(L,argc)) fatal("too many input files");
+ lua_setoptlevel(L,optlevel);
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
   if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
  }
+ if (counting)				/* run each chunk, without arguments */
+ {
+  luaL_openlibs(L);
+  for (i=0; i<argc; i++)
+  {
+   lua_pushvalue(L,i-argc);
+   if (lua_pcall(L,0,0,0)!=LUA_OK) fatal(lua_tostring(L,-1));
+  }
+ }
  f=combine(L,argc);
- if (listing) luaU_print(f,listing>1);
+ if (listing)
+ {
+  loaddebug(L,(Proto*)f);
+  luaU_print(f,listing>1);
+ }
  if (dumping)
  {
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  luaU_dump(L,f,writer,D,stripping);
+  luaU_dump(L,f,writer,D,stripping,imaging);
   lua_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
@@ -284,6 +330,8 @@ static void PrintConstant(const Proto* f, int i)
 
 #define UPVALNAME(x) ((f->upvalues[x].name) ? getstr(f->upvalues[x].name) : "-")
 #define MYK(x)		(-1-(x))
+#define ISIMM(o)	((o)==OP_ADDI || (o)==OP_LTI || (o)==OP_LEI || \
+			 (o)==OP_GTI || (o)==OP_GEI)
 
 static void PrintCode(const Proto* f)
 {
@@ -299,16 +347,21 @@ static void PrintCode(const Proto* f)
   int ax=GETARG_Ax(i);
   int bx=GETARG_Bx(i);
   int sbx=GETARG_sBx(i);
-  int line=getfuncline(f,pc);
+  int line=luaG_getfuncline(f,pc);
   printf("\t%d\t",pc+1);
   if (line>0) printf("[%d]\t",line); else printf("[-]\t");
+#if defined(LUAI_OPSTATS)
+  if (counting) printf("%9lu\t",f->hits ? (unsigned long)f->hits[pc] : 0UL);
+#endif
   printf("%-9s\t",luaP_opnames[o]);
   switch (getOpMode(o))
   {
    case iABC:
     printf("%d",a);
     if (getBMode(o)!=OpArgN) printf(" %d",ISK(b) ? (MYK(INDEXK(b))) : b);
-    if (getCMode(o)!=OpArgN) printf(" %d",ISK(c) ? (MYK(INDEXK(c))) : c);
+    if (ISIMM(o)) printf(" %d",GETARG_sC(i));
+    else if (o==OP_ADDK || o==OP_EQK) printf(" %d",MYK(c));
+    else if (getCMode(o)!=OpArgN) printf(" %d",ISK(c) ? (MYK(INDEXK(c))) : c);
     break;
    case iABx:
     printf("%d",a);
@@ -332,6 +385,7 @@ static void PrintCode(const Proto* f)
     printf("\t; %s",UPVALNAME(b));
     break;
    case OP_GETTABUP:
+   case OP_GETTABUPF:
     printf("\t; %s",UPVALNAME(b));
     if (ISK(c)) { printf(" "); PrintConstant(f,INDEXK(c)); }
     break;
@@ -341,11 +395,14 @@ static void PrintCode(const Proto* f)
     if (ISK(c)) { printf(" "); PrintConstant(f,INDEXK(c)); }
     break;
    case OP_GETTABLE:
+   case OP_GETTABLEF:
+   case OP_GETTABLEAI:
    case OP_SELF:
     if (ISK(c)) { printf("\t; "); PrintConstant(f,INDEXK(c)); }
     break;
    case OP_SETTABLE:
    case OP_ADD:
+   case OP_ADDII:
    case OP_SUB:
    case OP_MUL:
    case OP_MOD:
@@ -368,6 +425,10 @@ static void PrintCode(const Proto* f)
      if (ISK(c)) PrintConstant(f,INDEXK(c)); else printf("-");
     }
     break;
+   case OP_ADDK:
+   case OP_EQK:
+    printf("\t; - "); PrintConstant(f,c);
+    break;
    case OP_JMP:
    case OP_FORLOOP:
    case OP_FORPREP:
@@ -72,6 +72,13 @@
 #endif
 
 
+/*
+@@ LUA_USE_JIT compiles hot Lua functions to native code (see ljit.c).
+** It is available only on x86-64 POSIX systems and ignored elsewhere.
+*/
+/* #define LUA_USE_JIT */
+
+
 /*
 @@ LUA_C89_NUMBERS ensures that Lua uses the largest types available for
 ** C89 ('long' and 'double'); Windows always has '__int64', so it does
@@ -0,0 +1,488 @@
+/*
+** $Id: luaheap.c $
+** Heap snapshot analyzer (dominators and retained sizes)
+** See Copyright Notice in lua.h
+*/
+
+#define luaheap_c
+
+#include "lprefix.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** Reads a snapshot written by 'lua_heapsnapshot' (see lprof.c) and
+** builds the graph of strong references, with a virtual root that
+** refers to all roots of the snapshot. The immediate dominator of an
+** object is the nearest object in all paths from the root to it; the
+** retained size of an object is the sum of the sizes of all objects it
+** dominates (including itself), that is, what would be freed if it
+** were not referenced anymore. Dominators are computed with the
+** iterative algorithm of Cooper, Harvey and Kennedy.
+*/
+
+#define PROGNAME	"luaheap"	/* default program name */
+
+static const char* progname=PROGNAME;	/* actual program name */
+static const char* input=NULL;		/* snapshot file name */
+static int top=20;			/* number of objects to list */
+static int paths=0;			/* show dominator chains? */
+
+static void fatal(const char* message)
+{
+ fprintf(stderr,"%s: %s\n",progname,message);
+ exit(EXIT_FAILURE);
+}
+
+static void cannot(const char* what)
+{
+ fprintf(stderr,"%s: cannot %s %s: %s\n",progname,what,input,strerror(errno));
+ exit(EXIT_FAILURE);
+}
+
+static void usage(const char* message)
+{
+ if (*message=='-')
+  fprintf(stderr,"%s: unrecognized option '%s'\n",progname,message);
+ else
+  fprintf(stderr,"%s: %s\n",progname,message);
+ fprintf(stderr,
+  "usage: %s [options] snapshot\n"
+  "Available options are:\n"
+  "  -n num   list the 'num' objects with largest retained sizes (default %d)\n"
+  "  -p       show the dominators of each listed object\n"
+  ,progname,top);
+ exit(EXIT_FAILURE);
+}
+
+#define IS(s)	(strcmp(argv[i],s)==0)
+
+static void doargs(int argc, char* argv[])
+{
+ int i;
+ if (argv[0]!=NULL && *argv[0]!=0) progname=argv[0];
+ for (i=1; i<argc; i++)
+ {
+  if (IS("-n"))
+  {
+   if (argv[++i]==NULL || (top=atoi(argv[i]))<=0) usage("'-n' needs argument");
+  }
+  else if (IS("-p"))
+   paths=1;
+  else if (*argv[i]=='-')
+   usage(argv[i]);
+  else if (input==NULL)
+   input=argv[i];
+  else
+   usage("too many arguments");
+ }
+ if (input==NULL) usage("no input file given");
+}
+
+static void* xrealloc(void* p, size_t n)
+{
+ p=realloc(p,n==0 ? 1 : n);
+ if (p==NULL) fatal("not enough memory");
+ return p;
+}
+
+/* ensure that vector 'v' of 't' (with capacity 'c') has room for 'n' items */
+#define GROW(v,c,n,t) \
+ do { if ((n)>=(c)) { c=(c)*2+64; v=(t*)xrealloc(v,(c)*sizeof(t)); } } while (0)
+
+/* the graph */
+static int nobjs=0,sizeobjs=0;
+static size_t* addr=NULL;		/* id of each object */
+static size_t* size=NULL;		/* its own size */
+static int* type=NULL;			/* index in 'types' */
+static long* label=NULL;		/* index in 'text' (or -1) */
+static long* first=NULL;		/* index in 'edges' of its references */
+static long nedges=0,sizeedges=0;
+static size_t* edges=NULL;		/* ids, then indices of referred objects */
+static int nroots=0,sizeroots=0;
+static size_t* roots=NULL;
+static int nlabels=0,sizelabels=0;
+static size_t* labelid=NULL;		/* labels read, with their objects */
+static long* labelpos=NULL;
+static long ntext=0,sizetext=0;
+static char* text=NULL;
+static int ntypes=0;
+static char types[16][16];
+
+/* {====================================================== */
+/* Reading */
+
+static FILE* f;
+static int c;				/* current character */
+
+#define next()	(c=getc(f))
+
+static void skipspaces(void)
+{
+ while (c==' ') next();
+}
+
+static size_t readid(void)
+{
+ size_t v=0;
+ skipspaces();
+ if (c=='0') { next(); if (c=='x' || c=='X') next(); }
+ if (!isxdigit(c)) fatal("bad snapshot (id expected)");
+ for (; isxdigit(c); next())
+  v=v*16+(isdigit(c) ? c-'0' : tolower(c)-'a'+10);
+ return v;
+}
+
+static size_t readnumber(void)
+{
+ size_t v=0;
+ skipspaces();
+ if (!isdigit(c)) fatal("bad snapshot (number expected)");
+ for (; isdigit(c); next()) v=v*10+(c-'0');
+ return v;
+}
+
+static int readtype(void)
+{
+ char name[16];
+ int n=0,i;
+ skipspaces();
+ for (; isalpha(c); next()) if (n<15) name[n++]=(char)c;
+ name[n]=0;
+ for (i=0; i<ntypes; i++) if (strcmp(types[i],name)==0) return i;
+ if (ntypes==16) fatal("bad snapshot (too many types)");
+ strcpy(types[ntypes],name);
+ return ntypes++;
+}
+
+static void readobject(void)
+{
+ if (nobjs>=sizeobjs)
+ {
+  GROW(addr,sizeobjs,nobjs,size_t);
+  size=(size_t*)xrealloc(size,sizeobjs*sizeof(*size));
+  type=(int*)xrealloc(type,sizeobjs*sizeof(*type));
+  label=(long*)xrealloc(label,sizeobjs*sizeof(*label));
+  first=(long*)xrealloc(first,(sizeobjs+1)*sizeof(*first));
+ }
+ addr[nobjs]=readid();
+ type[nobjs]=readtype();
+ size[nobjs]=readnumber();
+ label[nobjs]=-1;
+ first[nobjs]=nedges;
+ for (skipspaces(); c!='\n' && c!=EOF; skipspaces())
+ {
+  int weak=(c=='~');
+  size_t id;
+  if (weak) next();
+  id=readid();
+  if (!weak)				/* only strong references matter */
+  {
+   GROW(edges,sizeedges,nedges,size_t);
+   edges[nedges++]=id;
+  }
+ }
+ nobjs++;
+}
+
+static void readlabel(void)
+{
+ if (nlabels>=sizelabels)
+ {
+  GROW(labelid,sizelabels,nlabels,size_t);
+  labelpos=(long*)xrealloc(labelpos,sizelabels*sizeof(*labelpos));
+ }
+ labelid[nlabels]=readid();
+ labelpos[nlabels++]=ntext;
+ if (c==' ') next();
+ for (; c!='\n' && c!=EOF; next())
+ {
+  GROW(text,sizetext,ntext,char);
+  text[ntext++]=(char)c;
+ }
+ GROW(text,sizetext,ntext,char);
+ text[ntext++]=0;
+}
+
+static void readsnapshot(void)
+{
+ char header[32];
+ f=fopen(input,"rb");
+ if (f==NULL) cannot("open");
+ if (fgets(header,sizeof(header),f)==NULL
+  || strcmp(header,"lua-heapsnapshot 1\n")!=0)
+  fatal("not a heap snapshot");
+ for (next(); c!=EOF; next())
+ {
+  int kind=c;
+  next();
+  switch (kind)
+  {
+   case 'r':
+    GROW(roots,sizeroots,nroots,size_t);
+    roots[nroots++]=readid();
+    break;
+   case 'o':
+    readobject();
+    break;
+   case 'n':
+    readlabel();
+    break;
+   default:
+    fatal("bad snapshot (unknown item)");
+  }
+  skipspaces();
+  if (c!='\n') fatal("bad snapshot (end of line expected)");
+ }
+ if (ferror(f)) cannot("read");
+ fclose(f);
+ first=(long*)xrealloc(first,(nobjs+1)*sizeof(*first));
+ first[nobjs]=nedges;
+}
+
+/* }====================================================== */
+
+/* {====================================================== */
+/* Analysis */
+
+static int* hash=NULL;			/* object indices by id */
+static size_t sizehash;
+
+static size_t hashid(size_t id)
+{
+ return (id>>3)*2654435761u & (sizehash-1);
+}
+
+static void buildhash(void)
+{
+ int i;
+ for (sizehash=64; sizehash<2*(size_t)nobjs; sizehash*=2) ;
+ hash=(int*)xrealloc(hash,sizehash*sizeof(*hash));
+ for (i=0; (size_t)i<sizehash; i++) hash[i]=-1;
+ for (i=0; i<nobjs; i++)
+ {
+  size_t h=hashid(addr[i]);
+  while (hash[h]!=-1) h=(h+1)&(sizehash-1);
+  hash[h]=i;
+ }
+}
+
+static int find(size_t id)
+{
+ size_t h;
+ for (h=hashid(id); hash[h]!=-1; h=(h+1)&(sizehash-1))
+  if (addr[hash[h]]==id) return hash[h];
+ return -1;
+}
+
+/* graph with a virtual root (index 'nobjs') */
+static int* post=NULL;			/* postorder number of each object */
+static int* order=NULL;			/* objects in postorder */
+static int nreach=0;			/* number of reachable objects */
+static long* pfirst=NULL;		/* predecessors, like 'first'/'edges' */
+static int* preds=NULL;
+static int* idom=NULL;
+static size_t* retained=NULL;
+
+#define succ(v,i)	((v)==nobjs ? rootidx[i] : (int)edges[i])
+#define nsucc(v)	((v)==nobjs ? (long)nroots : first[(v)+1]-first[v])
+#define succbase(v)	((v)==nobjs ? 0 : first[v])
+
+static int* rootidx=NULL;
+
+/* resolve ids into indices, dropping references to unknown objects */
+static void resolve(void)
+{
+ int v,i;
+ long e,n=0;
+ for (v=0; v<nobjs; v++)
+ {
+  long b=first[v];
+  first[v]=n;
+  for (e=b; e<first[v+1]; e++)
+  {
+   int w=find(edges[e]);
+   if (w>=0) edges[n++]=(size_t)w;
+  }
+ }
+ first[nobjs]=nedges=n;
+ rootidx=(int*)xrealloc(rootidx,(nroots+1)*sizeof(*rootidx));
+ for (i=n=0; i<nroots; i++)
+ {
+  int w=find(roots[i]);
+  if (w>=0) rootidx[n++]=w;
+ }
+ nroots=(int)n;
+ for (i=0; i<nlabels; i++)
+ {
+  int w=find(labelid[i]);
+  if (w>=0) label[w]=labelpos[i];
+ }
+}
+
+/* depth-first search from the root, numbering objects in postorder */
+static void search(void)
+{
+ int* stack=(int*)xrealloc(NULL,(nobjs+1)*sizeof(int));
+ long* pos=(long*)xrealloc(NULL,(nobjs+1)*sizeof(long));
+ int n=0,v;
+ post=(int*)xrealloc(NULL,(nobjs+1)*sizeof(*post));
+ order=(int*)xrealloc(NULL,(nobjs+1)*sizeof(*order));
+ for (v=0; v<=nobjs; v++) post[v]=-1;
+ post[nobjs]=-2;			/* visited */
+ stack[n]=nobjs; pos[n++]=0;
+ while (n>0)
+ {
+  v=stack[n-1];
+  if (pos[n-1]<nsucc(v))
+  {
+   int w=succ(v,succbase(v)+pos[n-1]++);
+   if (post[w]==-1)
+   {
+    post[w]=-2;
+    stack[n]=w; pos[n++]=0;
+   }
+  }
+  else
+  {
+   order[nreach]=v;
+   post[v]=nreach++;
+   n--;
+  }
+ }
+ free(stack);
+ free(pos);
+}
+
+static void buildpreds(void)
+{
+ int v;
+ long i;
+ pfirst=(long*)xrealloc(NULL,(nobjs+2)*sizeof(*pfirst));
+ for (v=0; v<=nobjs+1; v++) pfirst[v]=0;
+ for (v=0; v<=nobjs; v++)
+  if (post[v]>=0)
+   for (i=0; i<nsucc(v); i++) pfirst[succ(v,succbase(v)+i)+1]++;
+ for (v=0; v<=nobjs; v++) pfirst[v+1]+=pfirst[v];
+ preds=(int*)xrealloc(NULL,(pfirst[nobjs+1]+1)*sizeof(*preds));
+ for (v=0; v<=nobjs; v++)
+  if (post[v]>=0)
+   for (i=0; i<nsucc(v); i++) preds[pfirst[succ(v,succbase(v)+i)]++]=v;
+ for (v=nobjs; v>0; v--) pfirst[v]=pfirst[v-1];	/* restore starts */
+ pfirst[0]=0;
+}
+
+static int intersect(int a, int b)
+{
+ while (a!=b)
+ {
+  while (post[a]<post[b]) a=idom[a];
+  while (post[b]<post[a]) b=idom[b];
+ }
+ return a;
+}
+
+static void dominators(void)
+{
+ int changed=1,k,v;
+ long i;
+ idom=(int*)xrealloc(NULL,(nobjs+1)*sizeof(*idom));
+ for (v=0; v<=nobjs; v++) idom[v]=-1;
+ idom[nobjs]=nobjs;
+ while (changed)
+ {
+  changed=0;
+  for (k=nreach-2; k>=0; k--)		/* reverse postorder, without root */
+  {
+   int d=-1;
+   v=order[k];
+   for (i=pfirst[v]; i<pfirst[v+1]; i++)
+   {
+    int p=preds[i];
+    if (idom[p]!=-1) d=(d==-1) ? p : intersect(p,d);
+   }
+   if (idom[v]!=d) { idom[v]=d; changed=1; }
+  }
+ }
+ retained=(size_t*)xrealloc(NULL,(nobjs+1)*sizeof(*retained));
+ for (v=0; v<nobjs; v++) retained[v]=size[v];
+ retained[nobjs]=0;
+ for (k=0; k<nreach-1; k++)		/* dominated objects come first */
+  retained[idom[order[k]]]+=retained[order[k]];
+}
+
+/* }====================================================== */
+
+/* {====================================================== */
+/* Report */
+
+static int byretained(const void* a, const void* b)
+{
+ size_t x=retained[*(const int*)a],y=retained[*(const int*)b];
+ return (x<y) ? 1 : (x>y) ? -1 : 0;
+}
+
+static void printobject(int v)
+{
+ printf("%s %#lx",types[type[v]],(unsigned long)addr[v]);
+ if (label[v]>=0) printf(" '%s'",text+label[v]);
+}
+
+static void report(void)
+{
+ size_t count[16],bytes[16],total=0,lost=0;
+ int* list;
+ int i,n=0;
+ for (i=0; i<ntypes; i++) count[i]=bytes[i]=0;
+ for (i=0; i<nobjs; i++)
+ {
+  count[type[i]]++;
+  bytes[type[i]]+=size[i];
+  total+=size[i];
+  if (post[i]<0) lost+=size[i];
+ }
+ printf("%d objects, %lu bytes (%d unreachable, %lu bytes)\n",
+	nobjs,(unsigned long)total,nobjs-(nreach-1),(unsigned long)lost);
+ printf("\n%-10s %10s %14s\n","type","count","bytes");
+ for (i=0; i<ntypes; i++)
+  printf("%-10s %10lu %14lu\n",types[i],(unsigned long)count[i],
+	(unsigned long)bytes[i]);
+ list=(int*)xrealloc(NULL,(nobjs+1)*sizeof(int));
+ for (i=0; i<nobjs; i++) if (post[i]>=0) list[n++]=i;
+ qsort(list,n,sizeof(int),byretained);
+ printf("\n%14s %10s  object\n","retained","size");
+ for (i=0; i<n && i<top; i++)
+ {
+  int v=list[i];
+  printf("%14lu %10lu  ",(unsigned long)retained[v],(unsigned long)size[v]);
+  printobject(v);
+  printf("\n");
+  if (paths)
+   for (v=idom[v]; v!=nobjs; v=idom[v])
+   {
+    printf("%26s","< ");
+    printobject(v);
+    printf("\n");
+   }
+ }
+ free(list);
+}
+
+/* }====================================================== */
+
+int main(int argc, char* argv[])
+{
+ doargs(argc,argv);
+ readsnapshot();
+ buildhash();
+ resolve();
+ search();
+ buildpreds();
+ dominators();
+ report();
+ return EXIT_SUCCESS;
+}
@@ -18,8 +18,10 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstring.h"
 #include "lundump.h"
 #include "lzio.h"
@@ -34,6 +36,10 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  int format;  /* LUAC_FORMAT or LUAC_IMAGEFORMAT */
+  size_t offset;  /* bytes read so far */
+  ChunkImage **img;  /* image to use in place (or NULL) */
+  ChunkImage *desc;  /* caller's description of that image */
 } LoadState;
 
 
@@ -52,6 +58,24 @@ static l_noret error(LoadState *S, const char *why) {
 static void LoadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated");
+  S->offset += size;
+}
+
+
+/*
+** Return the address of the next 'size' bytes of the chunk and skip
+** them, if they are contiguous in the buffer of the stream (as always
+** in images loaded in place); otherwise return NULL.
+*/
+static const char *LoadInPlace (LoadState *S, size_t size) {
+  ZIO *z = S->Z;
+  const char *p = z->p;
+  if (z->n < size)
+    return NULL;
+  z->p += size;
+  z->n -= size;
+  S->offset += size;
+  return p;
 }
 
 
@@ -94,8 +118,12 @@ static TString *LoadString (LoadState *S) {
     return NULL;
   else if (--size <= LUAI_MAXSHORTLEN) {  /* short string? */
     char buff[LUAI_MAXSHORTLEN];
-    LoadVector(S, buff, size);
-    return luaS_newlstr(S->L, buff, size);
+    const char *s = LoadInPlace(S, size);  /* try to avoid a copy */
+    if (s == NULL) {
+      LoadVector(S, buff, size);
+      s = buff;
+    }
+    return luaS_newlstr(S->L, s, size);
   }
   else {  /* long string */
     TString *ts = luaS_createlngstrobj(S->L, size);
@@ -105,11 +133,65 @@ static TString *LoadString (LoadState *S) {
 }
 
 
+/*
+** Arrays of code and line information in images start at offsets
+** (from the start of the chunk) that are multiples of their element
+** sizes, so that they can be used in place (see 'lua_loadimage').
+*/
+static void LoadAlign (LoadState *S, size_t align) {
+  if (S->format == LUAC_IMAGEFORMAT) {
+    while (S->offset % align != 0)
+      LoadByte(S);
+  }
+}
+
+
+/*
+** Make prototype 'f' use the image being loaded; the image shared by
+** the prototypes is created (from the caller's description) with its
+** first use, and the caller is told about it at once, as an error can
+** interrupt the load at any time.
+*/
+static void UseImage (LoadState *S, Proto *f) {
+  ChunkImage *img = *S->img;
+  if (img == S->desc) {  /* first use? */
+    img = luaM_new(S->L, ChunkImage);
+    *img = *S->desc;
+    img->nref = 0;
+    *S->img = img;
+  }
+  f->image = img;
+  img->nref++;
+}
+
+
+/*
+** Load an array of 'n' elements of size 'sz' in place (code in images
+** is saved already fused)
+*/
+static void *LoadArrayInPlace (LoadState *S, int n, size_t sz) {
+  const char *p = LoadInPlace(S, cast(size_t, n) * sz);
+  if (p == NULL || n < 0)
+    error(S, "truncated");
+  return (n == 0) ? NULL : cast(void *, p);
+}
+
+
 static void LoadCode (LoadState *S, Proto *f) {
   int n = LoadInt(S);
-  f->code = luaM_newvector(S->L, n, Instruction);
-  f->sizecode = n;
-  LoadVector(S, f->code, n);
+  LoadAlign(S, sizeof(Instruction));
+  if (S->img != NULL) {  /* use code in place? */
+    UseImage(S, f);
+    f->code = cast(Instruction *,
+                   LoadArrayInPlace(S, n, sizeof(Instruction)));
+    f->sizecode = n;
+  }
+  else {
+    f->code = luaM_newvector(S->L, n, Instruction);
+    f->sizecode = n;
+    LoadVector(S, f->code, n);
+    luaP_fuse(f->code, n);
+  }
 }
 
 
@@ -178,25 +260,74 @@ static void LoadUpvalues (LoadState *S, Proto *f) {
 }
 
 
-static void LoadDebug (LoadState *S, Proto *f) {
+/*
+** Load a name of the debug information of 'f' (which, when loaded
+** by 'luaU_loaddebug', may be already marked by the collector)
+*/
+static TString *LoadName (LoadState *S, Proto *f) {
+  TString *ts = LoadString(S);
+  if (ts != NULL)
+    luaC_objbarrier(S->L, f, ts);
+  return ts;
+}
+
+
+static void LoadNames (LoadState *S, Proto *f) {
   int i, n;
   n = LoadInt(S);
-  f->lineinfo = luaM_newvector(S->L, n, int);
-  f->sizelineinfo = n;
-  LoadVector(S, f->lineinfo, n);
-  n = LoadInt(S);
   f->locvars = luaM_newvector(S->L, n, LocVar);
   f->sizelocvars = n;
   for (i = 0; i < n; i++)
     f->locvars[i].varname = NULL;
   for (i = 0; i < n; i++) {
-    f->locvars[i].varname = LoadString(S);
+    f->locvars[i].varname = LoadName(S, f);
     f->locvars[i].startpc = LoadInt(S);
     f->locvars[i].endpc = LoadInt(S);
   }
   n = LoadInt(S);
+  if (n > f->sizeupvalues)
+    error(S, "corrupted");
   for (i = 0; i < n; i++)
-    f->upvalues[i].name = LoadString(S);
+    f->upvalues[i].name = LoadName(S, f);
+}
+
+
+/*
+** Images give the size of the names of local variables and upvalues,
+** so that, when used in place, they can be left there until needed
+** (see 'luaU_loaddebug'); line information is used in place, like the
+** code ('f' uses the image).
+*/
+static void LoadDebug (LoadState *S, Proto *f) {
+  int n = LoadInt(S);
+  if (S->img != NULL)
+    f->lineinfo = cast(ls_byte *, LoadArrayInPlace(S, n, sizeof(ls_byte)));
+  else {
+    f->lineinfo = luaM_newvector(S->L, n, ls_byte);
+    LoadVector(S, f->lineinfo, n);
+  }
+  f->sizelineinfo = n;
+  n = LoadInt(S);
+  LoadAlign(S, sizeof(int));
+  if (S->img != NULL)
+    f->abslineinfo = cast(AbsLineInfo *,
+                          LoadArrayInPlace(S, n, sizeof(AbsLineInfo)));
+  else {
+    f->abslineinfo = luaM_newvector(S->L, n, AbsLineInfo);
+    LoadVector(S, f->abslineinfo, n);
+  }
+  f->sizeabslineinfo = n;
+  if (S->format == LUAC_IMAGEFORMAT) {
+    size_t size;
+    LoadVar(S, size);
+    if (S->img != NULL && size > 2 * sizeof(int)) {  /* any names? */
+      f->debuginfo = S->offset;
+      if (LoadInPlace(S, size) == NULL)
+        error(S, "truncated");
+      return;
+    }
+  }
+  LoadNames(S, f);
 }
 
 
@@ -238,7 +369,8 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, LUA_SIGNATURE + 1, "not a");  /* 1st char already checked */
   if (LoadByte(S) != LUAC_VERSION)
     error(S, "version mismatch in");
-  if (LoadByte(S) != LUAC_FORMAT)
+  S->format = LoadByte(S);
+  if (S->format != LUAC_FORMAT && S->format != LUAC_IMAGEFORMAT)
     error(S, "format mismatch in");
   checkliteral(S, LUAC_DATA, "corrupted");
   checksize(S, int);
@@ -254,9 +386,55 @@ static void checkHeader (LoadState *S) {
 
 
 /*
-** load precompiled chunk
+** Can the chunk being loaded use image '*img' in place? It must be an
+** image, be all in the image's buffer, and be aligned.
+*/
+static int inplace (LoadState *S, ChunkImage **img) {
+  const char *start = S->Z->p - S->offset;  /* start of the chunk */
+  return (img != NULL && S->format == LUAC_IMAGEFORMAT &&
+          start == cast(const char *, (*img)->buff) &&
+          point2uint(start) % sizeof(Instruction) == 0 &&
+          point2uint(start) % sizeof(int) == 0);
+}
+
+
+static const char *noreader (lua_State *L, void *ud, size_t *size) {
+  UNUSED(L); UNUSED(ud);
+  *size = 0;
+  return NULL;
+}
+
+
+/*
+** Load the names of local variables and upvalues of 'f', which
+** 'luaU_undump' left in its image
+*/
+void luaU_loaddebug (lua_State *L, Proto *f) {
+  LoadState S;
+  ZIO z;
+  size_t offset = f->debuginfo;
+  lua_assert(f->image != NULL && 0 < offset && offset <= f->image->size);
+  f->debuginfo = 0;
+  luaZ_init(L, &z, noreader, NULL);
+  z.p = cast(const char *, f->image->buff) + offset;
+  z.n = f->image->size - offset;
+  S.L = L;
+  S.Z = &z;
+  S.name = "image";
+  S.format = LUAC_IMAGEFORMAT;
+  S.offset = offset;
+  S.img = NULL;
+  S.desc = NULL;
+  LoadNames(&S, f);
+}
+
+
+/*
+** load precompiled chunk; if 'img' is not NULL, the whole chunk is in
+** the buffer of stream 'Z' described by '*img'
 */
-LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
+LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name,
+                      ChunkImage **img) {
   LoadState S;
   LClosure *cl;
   if (*name == '@' || *name == '=')
@@ -267,7 +445,10 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.offset = 1;  /* 1st char already read */
   checkHeader(&S);
+  S.img = inplace(&S, img) ? img : NULL;
+  S.desc = (img != NULL) ? *img : NULL;
   cl = luaF_newLclosure(L, LoadByte(&S));
   setclLvalue(L, L->top, cl);
   luaD_inctop(L);
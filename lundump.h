@@ -20,13 +20,22 @@
 
 #define MYINT(s)	(s[0]-'0')
 #define LUAC_VERSION	(MYINT(LUA_VERSION_MAJOR)*16+MYINT(LUA_VERSION_MINOR))
-#define LUAC_FORMAT	0	/* this is the official format */
+#define LUAC_FORMAT	2	/* format of precompiled chunks (official is 0) */
+#define LUAC_IMAGEFORMAT	3	/* format of chunk images */
 
 /* load one chunk; from lundump.c */
-LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
+LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name,
+                                 ChunkImage** img);
+
+/* load the names left in the image of a prototype; from lundump.c */
+LUAI_FUNC void luaU_loaddebug (lua_State* L, Proto* f);
+
+/* make sure the names in the debug information of 'f' are loaded */
+#define luaU_needdebug(L,f)  \
+	((f)->debuginfo == 0 ? (void)0 : luaU_loaddebug(L, f))
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
-                         void* data, int strip);
+                         void* data, int strip, int image);
 
 #endif
@@ -23,8 +23,10 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lprof.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -663,22 +665,25 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
-  Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
+  /* interrupted instruction (fused ones finish as their first part) */
+  Instruction inst = luaP_generic(*(ci->u.l.savedpc - 1));
   OpCode op = GET_OPCODE(inst);
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
     case OP_MOD: case OP_POW:
     case OP_UNM: case OP_BNOT: case OP_LEN:
+    case OP_ADDI: case OP_ADDK:
     case OP_GETTABUP: case OP_GETTABLE: case OP_SELF: {
       setobjs2s(L, base + GETARG_A(inst), --L->top);
       break;
     }
-    case OP_LE: case OP_LT: case OP_EQ: {
+    case OP_LE: case OP_LT: case OP_EQ:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
       int res = !l_isfalse(L->top - 1);
       L->top--;
       if (ci->callstatus & CIST_LEQ) {  /* "<=" using "<" instead? */
-        lua_assert(op == OP_LE);
+        lua_assert(op == OP_LE || op == OP_LEI || op == OP_GEI);
         ci->callstatus ^= CIST_LEQ;  /* clear mark */
         res = !res;  /* negate result */
       }
@@ -751,19 +756,68 @@ void luaV_finishOp (lua_State *L) {
 /* for test instructions, execute the jump instruction that follows it */
 #define donextjump(ci)	{ i = *ci->u.l.savedpc; dojump(ci, i, 1); }
 
+/* at a loop back edge, switch to native code if function has (or gets) it */
+#define jitloop()	{ if (luaJ_ready(L, cl->p)) goto newframe; }
+
 
 #define Protect(x)	{ {x;}; base = ci->u.l.base; }
 
+
+/*
+** Quickening: rewrite the current instruction into its specialized form
+** 'o' (after executing it with the operand types that 'o' expects), or
+** back into its generic form after a type miss. Can be turned off by
+** defining LUAI_NOQUICKEN. Code in chunk images is never written (see
+** 'lua_loadimage'), so it is not quickened.
+*/
+#define setcurop(o)  \
+	SET_OPCODE(cl->p->code[ci->u.l.savedpc - cl->p->code - 1], o)
+
+#if !defined(LUAI_NOQUICKEN)
+#define quicken(o)	{ if (cl->p->image == NULL) setcurop(o); }
+#else
+#define quicken(o)	((void)0)
+#endif
+
+#define unquicken(o)	setcurop(o)
+
+/* both 'a' and 'b' are integers (with a single test) */
+#define ttisintpair(a,b)  \
+	(((rttype(a) << 8) | rttype(b)) == ((LUA_TNUMINT << 8) | LUA_TNUMINT))
+
 #define checkGC(L,c)  \
 	{ luaC_condGC(L, L->top = (c),  /* limit of live values */ \
                          Protect(L->top = ci->top));  /* restore top */ \
            luai_threadyield(L); }
 
 
+/*
+** Opcode statistics (build with LUAI_OPSTATS): count executions of
+** each opcode, opcode pair and instruction (see 'lua_getopstats').
+*/
+#if defined(LUAI_OPSTATS)
+
+#define countop(L,i)	{ \
+  global_State *g_ = G(L); OpCode o_ = GET_OPCODE(i); \
+  g_->opcount[o_]++; g_->oppairs[g_->lastop][o_]++; g_->lastop = o_; \
+  cl->p->hits[ci->u.l.savedpc - cl->p->code - 1]++; }
+
+#define checkhits(L,p)  \
+	{ if ((p)->hits == NULL) Protect(luaR_newhits(L, p)); }
+
+#else
+
+#define countop(L,i)	((void)0)
+#define checkhits(L,p)	((void)0)
+
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   i = *(ci->u.l.savedpc++); \
-  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
+  countop(L, i); \
+  if (L->hookmask & TRACEMASK) \
     Protect(luaG_traceexec(L)); \
   ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
   lua_assert(base == ci->u.l.base); \
@@ -790,6 +844,51 @@ void luaV_finishOp (lua_State *L) {
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
+/*
+** Global cache: reads of a constant key from an upvalue (usually
+** '_ENV') remember, per prototype and constant, the slot where the key
+** was found and the version of its table. While the table keeps that
+** version, the slot is still the key's slot, so a hit costs a couple
+** of compares instead of a hash lookup. Absent keys and nil values
+** are not cached (they may need '__index'). Can be turned off by
+** defining LUAI_NOGCACHE.
+*/
+#if !defined(LUAI_NOGCACHE)
+
+static const TValue *cachedget (Proto *p, Table *h, int idx) {
+  GlobalCache *gc = &p->gcache[idx];
+  const TValue *slot;
+  if (gc->t == h && gc->version == h->version)  /* hit? */
+    slot = gc->slot;
+  else if (ttisshrstring(&p->k[idx])) {
+    slot = luaH_getshortstr(h, tsvalue(&p->k[idx]));
+    if (slot == luaO_nilobject)  /* absent key? */
+      return NULL;
+    gc->t = h; gc->version = h->version; gc->slot = slot;
+  }
+  else return NULL;
+  return ttisnil(slot) ? NULL : slot;
+}
+
+/* 'gettableProtected' for OP_GETTABUP, with upvalue 't' */
+#define getglobalProtected(L,t,i,r) { const TValue *slot_; \
+  int c_ = GETARG_C(i); \
+  if (ISK(c_) && cl->p->gcache == NULL) { \
+    Protect(luaF_newgcache(L, cl->p)); \
+    r = RA(i); t = cl->upvals[GETARG_B(i)]->v; } \
+  if (ISK(c_) && ttistable(t) && \
+      (slot_ = cachedget(cl->p, hvalue(t), INDEXK(c_))) != NULL) \
+    { setobj2s(L, r, slot_); } \
+  else { TValue *rc_ = RKC(i); gettableProtected(L, t, rc_, r); } }
+
+#else
+
+#define getglobalProtected(L,t,i,r) \
+	{ TValue *rc_ = RKC(i); gettableProtected(L, t, rc_, r); }
+
+#endif
+
+
 
 /*
 ** luaV_execute函数是一个循环遍历的状态机,通过遍历二进制操作码的数组,逐个执行指令
@@ -808,6 +907,14 @@ void luaV_execute (lua_State *L) {
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
+  checkhits(L, cl->p);
+  if (luaJ_ready(L, cl->p)) {  /* can run native code? */
+    if (luaJ_run(L, ci)) {  /* native code called a Lua function? */
+      ci = L->ci;
+      goto newframe;  /* run it */
+    }
+    base = ci->u.l.base;  /* continue here, from 'savedpc' */
+  }
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
@@ -855,16 +962,59 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_GETTABUP) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
-        TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        getglobalProtected(L, upval, i, ra);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
+        if (ttistable(rb) && ttisinteger(rc))
+          quicken(OP_GETTABLEAI);
         gettableProtected(L, rb, rc, ra);
         vmbreak;
       }
+      vmcase(OP_GETTABLEAI) {
+        StkId rb = RB(i);
+        TValue *rc = RKC(i);
+        if (ttistable(rb) && ttisinteger(rc)) {
+          Table *h = hvalue(rb);
+          lua_Unsigned idx = l_castS2U(ivalue(rc)) - 1;
+          if (idx < h->sizearray && !ttisnil(&h->array[idx])) {
+            setobj2s(L, ra, &h->array[idx]);
+            vmbreak;
+          }
+        }
+        else unquicken(OP_GETTABLE);
+        gettableProtected(L, rb, rc, ra);
+        vmbreak;
+      }
+      vmcase(OP_GETTABUPF) {
+        TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        getglobalProtected(L, upval, i, ra);
+        goto l_getnext;
+      }
+      vmcase(OP_GETTABLEF) {
+       l_gettablef: {
+          StkId rb = RB(i);
+          TValue *rc = RKC(i);
+          gettableProtected(L, rb, rc, ra);
+        }
+       l_getnext:
+        if (L->hookmask & TRACEMASK)
+          vmbreak;  /* next instruction must go through the hooks */
+        i = *(ci->u.l.savedpc++);  /* go to next instruction (a GETTABLE) */
+        countop(L, i);
+        ra = RA(i);
+        if (GET_OPCODE(i) == OP_GETTABLEF)  /* a chain of fused gets? */
+          goto l_gettablef;
+        lua_assert(GET_OPCODE(luaP_generic(i)) == OP_GETTABLE);
+        {
+          StkId rb = RB(i);
+          TValue *rc = RKC(i);
+          gettableProtected(L, rb, rc, ra);
+        }
+        vmbreak;
+      }
       vmcase(OP_SETTABUP) {
         TValue *upval = cl->upvals[GETARG_A(i)]->v;
         TValue *rb = RKB(i);
@@ -910,6 +1060,56 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Number nb; lua_Number nc;
+        if (ttisinteger(rb) && ttisinteger(rc)) {
+          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
+          setivalue(ra, intop(+, ib, ic));
+          if (!ISK(GETARG_B(i)) && !ISK(GETARG_C(i)))
+            quicken(OP_ADDII);
+        }
+        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+          setfltvalue(ra, luai_numadd(L, nb, nc));
+        }
+        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
+        vmbreak;
+      }
+      vmcase(OP_ADDII) {
+        StkId rb = RB(i);
+        StkId rc = RC(i);
+        lua_Number nb; lua_Number nc;
+        if (ttisintpair(rb, rc)) {
+          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
+          setivalue(ra, intop(+, ib, ic));
+          vmbreak;
+        }
+        unquicken(OP_ADD);
+        if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+          setfltvalue(ra, luai_numadd(L, nb, nc));
+        }
+        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
+        vmbreak;
+      }
+      vmcase(OP_ADDI) {
+        TValue *rb = RB(i);
+        int ic = GETARG_sC(i);
+        lua_Number nb;
+        if (ttisinteger(rb)) {
+          lua_Integer ib = ivalue(rb);
+          setivalue(ra, intop(+, ib, ic));
+        }
+        else if (tonumber(rb, &nb)) {
+          setfltvalue(ra, luai_numadd(L, nb, cast_num(ic)));
+        }
+        else {
+          TValue rc;
+          setivalue(&rc, ic);
+          Protect(luaT_trybinTM(L, rb, &rc, ra, TM_ADD));
+        }
+        vmbreak;
+      }
+      vmcase(OP_ADDK) {
+        TValue *rb = RB(i);
+        TValue *rc = k + GETARG_C(i);
+        lua_Number nb; lua_Number nc;
         if (ttisinteger(rb) && ttisinteger(rc)) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, intop(+, ib, ic));
@@ -1081,7 +1281,23 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_LEN) {
-        Protect(luaV_objlen(L, ra, RB(i)));
+        StkId rb = RB(i);
+        if (ttistable(rb))
+          quicken(OP_LENT);
+        Protect(luaV_objlen(L, ra, rb));
+        vmbreak;
+      }
+      vmcase(OP_LENT) {
+        StkId rb = RB(i);
+        if (ttistable(rb)) {
+          Table *h = hvalue(rb);
+          if (fasttm(L, h->metatable, TM_LEN) == NULL) {
+            setivalue(ra, luaH_getn(h));
+            vmbreak;
+          }
+        }
+        else unquicken(OP_LEN);
+        Protect(luaV_objlen(L, ra, rb));
         vmbreak;
       }
       vmcase(OP_CONCAT) {
@@ -1099,6 +1315,7 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sBx(i) < 0) jitloop();
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1112,6 +1329,14 @@ void luaV_execute (lua_State *L) {
         )
         vmbreak;
       }
+      vmcase(OP_EQK) {
+        /* a constant has no '__eq', so a raw comparison is enough */
+        if (luaV_rawequalobj(RB(i), k + GETARG_C(i)) != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
       vmcase(OP_LT) {
         Protect(
           if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
@@ -1130,6 +1355,82 @@ void luaV_execute (lua_State *L) {
         )
         vmbreak;
       }
+      vmcase(OP_LTI) {
+        TValue *rb = RB(i);
+        int im = GETARG_sC(i);
+        int res;
+        if (ttisinteger(rb))
+          res = (ivalue(rb) < im);
+        else if (ttisfloat(rb))  /* 'im' is exact as a float */
+          res = luai_numlt(fltvalue(rb), cast_num(im));
+        else {
+          TValue rc;
+          setivalue(&rc, im);
+          Protect(res = luaV_lessthan(L, rb, &rc));
+        }
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_LEI) {
+        TValue *rb = RB(i);
+        int im = GETARG_sC(i);
+        int res;
+        if (ttisinteger(rb))
+          res = (ivalue(rb) <= im);
+        else if (ttisfloat(rb))
+          res = luai_numle(fltvalue(rb), cast_num(im));
+        else {
+          TValue rc;
+          setivalue(&rc, im);
+          Protect(res = luaV_lessequal(L, rb, &rc));
+        }
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_GTI) {
+        TValue *rb = RB(i);
+        int im = GETARG_sC(i);
+        int res;
+        if (ttisinteger(rb))
+          res = (im < ivalue(rb));
+        else if (ttisfloat(rb))
+          res = luai_numlt(cast_num(im), fltvalue(rb));
+        else {  /* keep original order of operands ('im < rb') */
+          TValue rc;
+          setivalue(&rc, im);
+          Protect(res = luaV_lessthan(L, &rc, rb));
+        }
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_GEI) {
+        TValue *rb = RB(i);
+        int im = GETARG_sC(i);
+        int res;
+        if (ttisinteger(rb))
+          res = (im <= ivalue(rb));
+        else if (ttisfloat(rb))
+          res = luai_numle(cast_num(im), fltvalue(rb));
+        else {  /* keep original order of operands ('im <= rb') */
+          TValue rc;
+          setivalue(&rc, im);
+          Protect(res = luaV_lessequal(L, &rc, rb));
+        }
+        if (res != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
       vmcase(OP_TEST) {
         if (GETARG_C(i) ? l_isfalse(ra) : !l_isfalse(ra))
             ci->u.l.savedpc++;
@@ -1151,6 +1452,24 @@ void luaV_execute (lua_State *L) {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
+        if (ttisLclosure(ra) && !(L->hookmask & LUA_MASKCALL) &&
+            ci->next != NULL) {  /* try inline version of 'luaD_precall' */
+          Proto *p = clLvalue(ra)->p;
+          if (!p->is_vararg && L->stack_last - ra > p->maxstacksize) {
+            CallInfo *nci = ci->next;
+            StkId nbase = ra + 1;
+            while (L->top < nbase + p->numparams)  /* missing arguments */
+              setnilvalue(L->top++);
+            nci->nresults = nresults;
+            nci->func = ra;
+            nci->u.l.base = nbase;
+            L->top = nci->top = nbase + p->maxstacksize;
+            nci->u.l.savedpc = p->code;
+            nci->callstatus = CIST_LUA;
+            ci = L->ci = nci;
+            goto newframe;  /* run the called function */
+          }
+        }
         if (luaD_precall(L, ra, nresults)) {  /* C function? */
           if (nresults >= 0)
             L->top = ci->top;  /* adjust results */
@@ -1196,6 +1515,29 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_RETURN) {
         int b = GETARG_B(i);
         if (cl->p->sizep > 0) luaF_close(L, base);
+        if (!(ci->callstatus & CIST_FRESH) &&
+            !(L->hookmask & (LUA_MASKRET | LUA_MASKLINE))) {
+          /* inline version of 'luaD_poscall' for Lua callers */
+          int nres = (b != 0) ? b - 1 : cast_int(L->top - ra);
+          int wanted = ci->nresults;
+          StkId res = ci->func;
+          int n;
+          ci = L->ci = ci->previous;
+          lua_assert(isLua(ci));
+          if (wanted == LUA_MULTRET) {
+            for (n = 0; n < nres; n++)
+              setobjs2s(L, res + n, ra + n);
+            L->top = res + nres;
+          }
+          else {
+            for (n = 0; n < wanted && n < nres; n++)
+              setobjs2s(L, res + n, ra + n);
+            for (; n < wanted; n++)  /* complete with nils */
+              setnilvalue(res + n);
+            L->top = ci->top;
+          }
+          goto newframe;
+        }
         b = luaD_poscall(L, ci, ra, (b != 0 ? b - 1 : cast_int(L->top - ra)));
         if (ci->callstatus & CIST_FRESH)  /* local 'ci' still from callee */
           return;  /* external invocation: return */
@@ -1216,6 +1558,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            jitloop();
           }
         }
         else {  /* floating loop */
@@ -1227,6 +1570,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            jitloop();
           }
         }
         vmbreak;
@@ -1277,6 +1621,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+           jitloop();
         }
         vmbreak;
       }